@@ -0,0 +1,770 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CompressedFrameFile_h
+#define CompressedFrameFile_h
+
+#include "common/NonCopyable.h"
+#include "common/condition.h"
+#include "common/lock.h"
+
+#ifdef __ENABLE_ZSTD__
+#include <zstd.h>
+#endif
+
+#ifdef __ENABLE_LZ4__
+#include <lz4.h>
+#endif
+
+#include <algorithm>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+//Raw frames compressed one by one, so a reader can seek to any frame.
+//  header:  "YAMIFRZ1", codec, frame size
+//  frames:  packed size, raw size, packed data
+//  index:   offset, packed size, raw size of every frame
+//  trailer: index offset, frame count, "YAMIFRZI"
+//A file without index (the writer died) is still readable by walking the frames.
+//Both sides are plain FILE*, so the frame readers and writers don't know about it.
+//Errors go to stderr, psnr uses this without libyami.
+class CompressedFrameFile {
+public:
+    enum Codec {
+        CODEC_NONE,
+        CODEC_ZSTD,
+        CODEC_LZ4
+    };
+
+    //"zstd" or "lz4", NULL turns compression off.
+    //threads 0 means one per cpu, at most 4. set it before creating any file
+    static bool setCompression(const char* codec, uint32_t threads)
+    {
+        Codec c = CODEC_NONE;
+        if (codec && !parseCodec(codec, c))
+            return false;
+        settings().codec = c;
+        settings().threads = threads;
+        return true;
+    }
+
+    static bool enabled()
+    {
+        return settings().codec != CODEC_NONE;
+    }
+
+    static const char* codecs()
+    {
+#if defined(__ENABLE_ZSTD__) && defined(__ENABLE_LZ4__)
+        return "zstd, lz4";
+#elif defined(__ENABLE_ZSTD__)
+        return "zstd";
+#elif defined(__ENABLE_LZ4__)
+        return "lz4";
+#else
+        return "none";
+#endif
+    }
+
+    //every frameSize bytes written make one frame. a stream header of headerSize
+    //bytes written first, up to frameSize, is kept in a frame of its own
+    static FILE* create(const char* path, uint32_t frameSize, uint32_t headerSize = 0)
+    {
+        if (!enabled() || !frameSize || headerSize > frameSize)
+            return NULL;
+        Writer* writer = new Writer(settings().codec, frameSize, headerSize);
+        if (!writer->init(path, settings().threads)) {
+            writer->close();
+            delete writer;
+            return NULL;
+        }
+        cookie_io_functions_t funcs = { NULL, Writer::cookieWrite, NULL, Writer::cookieClose };
+        FILE* fp = fopencookie(writer, "wb", funcs);
+        if (!fp) {
+            writer->close();
+            delete writer;
+            return NULL;
+        }
+        //we copy into frames anyway
+        setvbuf(fp, NULL, _IONBF, 0);
+        return fp;
+    }
+
+    //same as fopen(path, "rb"), but a compressed file reads as the raw frames
+    static FILE* open(const char* path)
+    {
+        FILE* fp = fopen(path, "rb");
+        if (!fp)
+            return NULL;
+        char magic[MAGIC_SIZE];
+        if (fread(magic, 1, MAGIC_SIZE, fp) != MAGIC_SIZE || memcmp(magic, headerMagic(), MAGIC_SIZE)) {
+            rewind(fp);
+            return fp;
+        }
+        Reader* reader = new Reader(fp);
+        if (!reader->init()) {
+            fprintf(stderr, "%s is not a valid compressed frame file\n", path);
+            delete reader;
+            return NULL;
+        }
+        cookie_io_functions_t funcs = { Reader::cookieRead, NULL, Reader::cookieSeek, Reader::cookieClose };
+        FILE* ret = fopencookie(reader, "rb", funcs);
+        if (!ret)
+            delete reader;
+        return ret;
+    }
+
+private:
+    static const size_t MAGIC_SIZE = 8;
+    static const size_t HEADER_SIZE = MAGIC_SIZE + 8;
+    static const size_t FRAME_HEADER_SIZE = 8;
+    static const size_t INDEX_ENTRY_SIZE = 16;
+    static const size_t TRAILER_SIZE = 16 + MAGIC_SIZE;
+    static const uint32_t MAX_THREADS = 4;
+
+    static const char* headerMagic() { return "YAMIFRZ1"; }
+    static const char* trailerMagic() { return "YAMIFRZI"; }
+
+    struct Settings {
+        Settings()
+            : codec(CODEC_NONE)
+            , threads(0)
+        {
+        }
+        Codec codec;
+        uint32_t threads;
+    };
+
+    static Settings& settings()
+    {
+        static Settings s;
+        return s;
+    }
+
+    static bool supported(uint32_t codec)
+    {
+#ifdef __ENABLE_ZSTD__
+        if (codec == CODEC_ZSTD)
+            return true;
+#endif
+#ifdef __ENABLE_LZ4__
+        if (codec == CODEC_LZ4)
+            return true;
+#endif
+        return false;
+    }
+
+    static bool parseCodec(const char* name, Codec& codec)
+    {
+        if (!strcasecmp(name, "zstd"))
+            codec = CODEC_ZSTD;
+        else if (!strcasecmp(name, "lz4"))
+            codec = CODEC_LZ4;
+        else
+            codec = CODEC_NONE;
+        if (!supported(codec)) {
+            fprintf(stderr, "compression %s is not supported, we have: %s\n", name, codecs());
+            return false;
+        }
+        return true;
+    }
+
+    //the file is little endian whatever the host is
+    static void put32(uint8_t* p, uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            p[i] = (uint8_t)(v >> (i * 8));
+    }
+    static void put64(uint8_t* p, uint64_t v)
+    {
+        put32(p, (uint32_t)v);
+        put32(p + 4, (uint32_t)(v >> 32));
+    }
+    static uint32_t get32(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    static uint64_t get64(const uint8_t* p)
+    {
+        return get32(p) | ((uint64_t)get32(p + 4) << 32);
+    }
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint32_t packedSize;
+        uint32_t rawSize;
+    };
+
+    //one per thread, keeps the library contexts around
+    class Codecs {
+    public:
+        Codecs()
+        {
+#ifdef __ENABLE_ZSTD__
+            m_cctx = NULL;
+            m_dctx = NULL;
+#endif
+        }
+        ~Codecs()
+        {
+#ifdef __ENABLE_ZSTD__
+            ZSTD_freeCCtx(m_cctx);
+            ZSTD_freeDCtx(m_dctx);
+#endif
+        }
+
+        static size_t bound(Codec codec, uint32_t size)
+        {
+#ifdef __ENABLE_ZSTD__
+            if (codec == CODEC_ZSTD)
+                return ZSTD_compressBound(size);
+#endif
+#ifdef __ENABLE_LZ4__
+            if (codec == CODEC_LZ4)
+                return LZ4_compressBound(size);
+#endif
+            return 0;
+        }
+
+        //return packed size, 0 on failure
+        size_t compress(Codec codec, uint8_t* dest, size_t capacity, const uint8_t* src, uint32_t size)
+        {
+#ifdef __ENABLE_ZSTD__
+            if (codec == CODEC_ZSTD) {
+                if (!m_cctx)
+                    m_cctx = ZSTD_createCCtx();
+                //frames are big and we are on the output path, favor speed
+                size_t ret = m_cctx ? ZSTD_compressCCtx(m_cctx, dest, capacity, src, size, 1) : 0;
+                return ZSTD_isError(ret) ? 0 : ret;
+            }
+#endif
+#ifdef __ENABLE_LZ4__
+            if (codec == CODEC_LZ4) {
+                int ret = LZ4_compress_default((const char*)src, (char*)dest, size, capacity);
+                return ret > 0 ? ret : 0;
+            }
+#endif
+            return 0;
+        }
+
+        bool decompress(Codec codec, uint8_t* dest, uint32_t size, const uint8_t* src, uint32_t packedSize)
+        {
+#ifdef __ENABLE_ZSTD__
+            if (codec == CODEC_ZSTD) {
+                if (!m_dctx)
+                    m_dctx = ZSTD_createDCtx();
+                return m_dctx && ZSTD_decompressDCtx(m_dctx, dest, size, src, packedSize) == size;
+            }
+#endif
+#ifdef __ENABLE_LZ4__
+            if (codec == CODEC_LZ4)
+                return LZ4_decompress_safe((const char*)src, (char*)dest, packedSize, size) == (int)size;
+#endif
+            return false;
+        }
+
+    private:
+#ifdef __ENABLE_ZSTD__
+        ZSTD_CCtx* m_cctx;
+        ZSTD_DCtx* m_dctx;
+#endif
+        DISALLOW_COPY_AND_ASSIGN(Codecs);
+    };
+
+    //Frames are filled by the caller and compressed by the workers,
+    //the caller writes them out in order when it needs the slot again.
+    class Writer {
+    public:
+        Writer(Codec codec, uint32_t frameSize, uint32_t headerSize)
+            : m_fp(NULL)
+            , m_codec(codec)
+            , m_frameSize(frameSize)
+            , m_headerSize(headerSize)
+            , m_offset(HEADER_SIZE)
+            , m_filling(false)
+            , m_error(false)
+            , m_cond(m_lock)
+            , m_submitted(0)
+            , m_started(0)
+            , m_retired(0)
+            , m_quit(false)
+        {
+        }
+
+        ~Writer()
+        {
+            for (size_t i = 0; i < m_jobs.size(); i++) {
+                free(m_jobs[i].raw);
+                free(m_jobs[i].packed);
+            }
+        }
+
+        bool init(const char* path, uint32_t threads)
+        {
+            if (!threads) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : cpus;
+            }
+            m_fp = fopen(path, "wb");
+            if (!m_fp) {
+                fprintf(stderr, "can't open %s\n", path);
+                return false;
+            }
+            uint8_t header[HEADER_SIZE];
+            memcpy(header, headerMagic(), MAGIC_SIZE);
+            put32(header + MAGIC_SIZE, m_codec);
+            put32(header + MAGIC_SIZE + 4, m_frameSize);
+            if (fwrite(header, 1, HEADER_SIZE, m_fp) != HEADER_SIZE)
+                return false;
+
+            //two frames per worker keep them busy while we write
+            size_t capacity = Codecs::bound(m_codec, m_frameSize);
+            m_jobs.resize(threads * 2);
+            for (size_t i = 0; i < m_jobs.size(); i++) {
+                Job& job = m_jobs[i];
+                job.raw = (uint8_t*)malloc(m_frameSize);
+                job.packed = (uint8_t*)malloc(FRAME_HEADER_SIZE + capacity);
+                job.capacity = capacity;
+                if (!job.raw || !job.packed)
+                    return false;
+            }
+            for (uint32_t i = 0; i < threads; i++) {
+                pthread_t thread;
+                if (pthread_create(&thread, NULL, start, this)) {
+                    fprintf(stderr, "create compress thread failed\n");
+                    return false;
+                }
+                m_threads.push_back(thread);
+            }
+            return true;
+        }
+
+        //0 on error, fopencookie() wants no negative count, m_error stays set for close
+        ssize_t write(const char* buf, size_t size)
+        {
+            size_t done = 0;
+            while (done < size) {
+                if (m_error || (!m_filling && !beginFrame()))
+                    return 0;
+                Job& job = m_jobs[m_submitted % m_jobs.size()];
+                uint32_t frameSize = (!m_submitted && m_headerSize) ? m_headerSize : m_frameSize;
+                size_t n = std::min(size - done, (size_t)(frameSize - job.rawSize));
+                memcpy(job.raw + job.rawSize, buf + done, n);
+                job.rawSize += n;
+                done += n;
+                if (job.rawSize == frameSize)
+                    submit();
+            }
+            return size;
+        }
+
+        //write what's left, the index and the trailer
+        int close()
+        {
+            if (m_filling && m_jobs[m_submitted % m_jobs.size()].rawSize)
+                submit();
+            while (m_retired != m_submitted) {
+                if (!retire())
+                    m_error = true;
+            }
+            {
+                AutoLock lock(m_lock);
+                m_quit = true;
+                m_cond.broadcast();
+            }
+            for (size_t i = 0; i < m_threads.size(); i++)
+                pthread_join(m_threads[i], NULL);
+            m_threads.clear();
+            if (!m_fp)
+                return -1;
+            if (!m_error)
+                m_error = !writeIndex();
+            if (fclose(m_fp))
+                m_error = true;
+            m_fp = NULL;
+            return m_error ? -1 : 0;
+        }
+
+        static ssize_t cookieWrite(void* cookie, const char* buf, size_t size)
+        {
+            return ((Writer*)cookie)->write(buf, size);
+        }
+
+        static int cookieClose(void* cookie)
+        {
+            Writer* writer = (Writer*)cookie;
+            int ret = writer->close();
+            delete writer;
+            return ret;
+        }
+
+    private:
+        struct Job {
+            Job()
+                : raw(NULL)
+                , rawSize(0)
+                , packed(NULL)
+                , packedSize(0)
+                , capacity(0)
+                , done(false)
+            {
+            }
+            uint8_t* raw;
+            uint32_t rawSize;
+            //with the frame header in front
+            uint8_t* packed;
+            size_t packedSize;
+            size_t capacity;
+            bool done;
+        };
+
+        //get the next slot, write out its old frame if needed
+        bool beginFrame()
+        {
+            if (m_submitted - m_retired == m_jobs.size() && !retire()) {
+                m_error = true;
+                return false;
+            }
+            Job& job = m_jobs[m_submitted % m_jobs.size()];
+            job.rawSize = 0;
+            {
+                AutoLock lock(m_lock);
+                job.done = false;
+            }
+            m_filling = true;
+            return true;
+        }
+
+        void submit()
+        {
+            AutoLock lock(m_lock);
+            m_submitted++;
+            m_filling = false;
+            m_cond.broadcast();
+        }
+
+        bool retire()
+        {
+            Job& job = m_jobs[m_retired % m_jobs.size()];
+            {
+                AutoLock lock(m_lock);
+                while (!job.done)
+                    m_cond.wait();
+            }
+            m_retired++;
+            if (!job.packedSize) {
+                fprintf(stderr, "compress frame failed\n");
+                return false;
+            }
+            if (fwrite(job.packed, 1, job.packedSize, m_fp) != job.packedSize)
+                return false;
+            IndexEntry entry;
+            entry.offset = m_offset;
+            entry.packedSize = job.packedSize - FRAME_HEADER_SIZE;
+            entry.rawSize = job.rawSize;
+            m_index.push_back(entry);
+            m_offset += job.packedSize;
+            return true;
+        }
+
+        bool writeIndex()
+        {
+            std::vector<uint8_t> index(m_index.size() * INDEX_ENTRY_SIZE + TRAILER_SIZE);
+            uint8_t* p = &index[0];
+            for (size_t i = 0; i < m_index.size(); i++, p += INDEX_ENTRY_SIZE) {
+                put64(p, m_index[i].offset);
+                put32(p + 8, m_index[i].packedSize);
+                put32(p + 12, m_index[i].rawSize);
+            }
+            put64(p, m_offset);
+            put32(p + 8, m_index.size());
+            put32(p + 12, 0);
+            memcpy(p + 16, trailerMagic(), MAGIC_SIZE);
+            return fwrite(&index[0], 1, index.size(), m_fp) == index.size();
+        }
+
+        static void* start(void* writer)
+        {
+            ((Writer*)writer)->loop();
+            return NULL;
+        }
+
+        void loop()
+        {
+            Codecs codecs;
+            while (1) {
+                Job* job;
+                {
+                    AutoLock lock(m_lock);
+                    while (m_started == m_submitted) {
+                        if (m_quit)
+                            return;
+                        m_cond.wait();
+                    }
+                    job = &m_jobs[m_started++ % m_jobs.size()];
+                }
+                size_t size = codecs.compress(m_codec, job->packed + FRAME_HEADER_SIZE, job->capacity,
+                    job->raw, job->rawSize);
+                if (size) {
+                    put32(job->packed, size);
+                    put32(job->packed + 4, job->rawSize);
+                    size += FRAME_HEADER_SIZE;
+                }
+
+                AutoLock lock(m_lock);
+                job->packedSize = size;
+                job->done = true;
+                m_cond.broadcast();
+            }
+        }
+
+        FILE* m_fp;
+        Codec m_codec;
+        uint32_t m_frameSize;
+        //size of the first frame, 0 if there is no stream header
+        uint32_t m_headerSize;
+        uint64_t m_offset;
+        std::vector<IndexEntry> m_index;
+        //the caller is filling m_jobs[m_submitted % size]
+        bool m_filling;
+        bool m_error;
+
+        std::vector<Job> m_jobs;
+        std::vector<pthread_t> m_threads;
+        Lock m_lock;
+        Condition m_cond;
+        //frame n lives in m_jobs[n % m_jobs.size()]
+        uint64_t m_submitted;
+        uint64_t m_started;
+        uint64_t m_retired;
+        bool m_quit;
+        DISALLOW_COPY_AND_ASSIGN(Writer);
+    };
+
+    //decompresses the frame under the read position and keeps it till we leave it
+    class Reader {
+    public:
+        Reader(FILE* fp)
+            : m_fp(fp)
+            , m_codec(CODEC_NONE)
+            , m_size(0)
+            , m_pos(0)
+            , m_cached(-1)
+        {
+        }
+
+        ~Reader()
+        {
+            fclose(m_fp);
+        }
+
+        bool init()
+        {
+            uint8_t header[HEADER_SIZE - MAGIC_SIZE];
+            if (fread(header, 1, sizeof(header), m_fp) != sizeof(header))
+                return false;
+            uint32_t codec = get32(header);
+            if (!supported(codec)) {
+                fprintf(stderr, "frames are compressed with codec %u, we have: %s\n", codec, codecs());
+                return false;
+            }
+            m_codec = (Codec)codec;
+            uint64_t framesEnd = 0;
+            if (!readIndex(framesEnd) && !scanFrames(framesEnd))
+                return false;
+            m_starts.resize(m_index.size());
+            for (size_t i = 0; i < m_index.size(); i++) {
+                m_starts[i] = m_size;
+                m_size += m_index[i].rawSize;
+            }
+            return true;
+        }
+
+        ssize_t read(char* buf, size_t size)
+        {
+            size_t done = 0;
+            while (done < size && m_pos < m_size) {
+                size_t frame = findFrame(m_pos);
+                if (!load(frame))
+                    return done ? (ssize_t)done : -1;
+                uint64_t offset = m_pos - m_starts[frame];
+                size_t n = std::min((uint64_t)(size - done), m_index[frame].rawSize - offset);
+                memcpy(buf + done, &m_raw[offset], n);
+                done += n;
+                m_pos += n;
+            }
+            return done;
+        }
+
+        int seek(off64_t* pos, int whence)
+        {
+            int64_t offset;
+            switch (whence) {
+            case SEEK_SET:
+                offset = *pos;
+                break;
+            case SEEK_CUR:
+                offset = m_pos + *pos;
+                break;
+            case SEEK_END:
+                offset = m_size + *pos;
+                break;
+            default:
+                return -1;
+            }
+            if (offset < 0)
+                return -1;
+            m_pos = offset;
+            *pos = offset;
+            return 0;
+        }
+
+        static ssize_t cookieRead(void* cookie, char* buf, size_t size)
+        {
+            return ((Reader*)cookie)->read(buf, size);
+        }
+
+        static int cookieSeek(void* cookie, off64_t* pos, int whence)
+        {
+            return ((Reader*)cookie)->seek(pos, whence);
+        }
+
+        static int cookieClose(void* cookie)
+        {
+            delete (Reader*)cookie;
+            return 0;
+        }
+
+    private:
+        //framesEnd is where the index starts if the trailer looks sane, even when an entry does not
+        bool readIndex(uint64_t& framesEnd)
+        {
+            uint8_t trailer[TRAILER_SIZE];
+            if (fseeko(m_fp, -(off_t)TRAILER_SIZE, SEEK_END)
+                || fread(trailer, 1, TRAILER_SIZE, m_fp) != TRAILER_SIZE
+                || memcmp(trailer + 16, trailerMagic(), MAGIC_SIZE))
+                return false;
+            uint64_t offset = get64(trailer);
+            uint32_t count = get32(trailer + 8);
+            //the index sits between the last frame and the trailer, anything else is a damaged trailer
+            uint64_t fileSize = ftello(m_fp);
+            if (offset < HEADER_SIZE || offset > fileSize
+                || fileSize - offset != (uint64_t)count * INDEX_ENTRY_SIZE + TRAILER_SIZE)
+                return badIndex();
+            framesEnd = offset;
+            std::vector<uint8_t> index((size_t)count * INDEX_ENTRY_SIZE);
+            if (fseeko(m_fp, offset, SEEK_SET)
+                || (count && fread(&index[0], 1, index.size(), m_fp) != index.size()))
+                return false;
+            m_index.resize(count);
+            for (uint32_t i = 0; i < count; i++) {
+                const uint8_t* p = &index[i * INDEX_ENTRY_SIZE];
+                m_index[i].offset = get64(p);
+                m_index[i].packedSize = get32(p + 8);
+                m_index[i].rawSize = get32(p + 12);
+                //frames lie between the header and the index
+                if (m_index[i].offset < HEADER_SIZE || m_index[i].offset > offset
+                    || offset - m_index[i].offset < FRAME_HEADER_SIZE + (uint64_t)m_index[i].packedSize)
+                    return badIndex();
+            }
+            return true;
+        }
+
+        bool badIndex()
+        {
+            fprintf(stderr, "compressed frame file has a damaged index\n");
+            m_index.clear();
+            return false;
+        }
+
+        //no index, walk the frame headers up to framesEnd, or the end of file if 0
+        bool scanFrames(uint64_t framesEnd)
+        {
+            fprintf(stderr, "compressed frame file has no usable index, scanning frames\n");
+            m_index.clear();
+            if (fseeko(m_fp, 0, SEEK_END))
+                return false;
+            uint64_t end = framesEnd ? framesEnd : ftello(m_fp);
+            uint64_t offset = HEADER_SIZE;
+            uint8_t header[FRAME_HEADER_SIZE];
+            while (!fseeko(m_fp, offset, SEEK_SET) && fread(header, 1, FRAME_HEADER_SIZE, m_fp) == FRAME_HEADER_SIZE) {
+                IndexEntry entry;
+                entry.offset = offset;
+                entry.packedSize = get32(header);
+                entry.rawSize = get32(header + 4);
+                //no frame is empty, this is the index: the high half of the first frame offset
+                if (!entry.rawSize)
+                    break;
+                offset += FRAME_HEADER_SIZE + entry.packedSize;
+                //a torn frame at the end
+                if (offset > end)
+                    break;
+                m_index.push_back(entry);
+            }
+            return true;
+        }
+
+        size_t findFrame(uint64_t pos)
+        {
+            if (m_cached >= 0 && pos >= m_starts[m_cached] && pos - m_starts[m_cached] < m_index[m_cached].rawSize)
+                return m_cached;
+            return std::upper_bound(m_starts.begin(), m_starts.end(), pos) - m_starts.begin() - 1;
+        }
+
+        bool load(size_t frame)
+        {
+            if ((int64_t)frame == m_cached)
+                return true;
+            const IndexEntry& entry = m_index[frame];
+            m_packed.resize(entry.packedSize);
+            m_raw.resize(entry.rawSize);
+            if (fseeko(m_fp, entry.offset + FRAME_HEADER_SIZE, SEEK_SET)
+                || fread(&m_packed[0], 1, entry.packedSize, m_fp) != entry.packedSize
+                || !m_codecs.decompress(m_codec, &m_raw[0], entry.rawSize, &m_packed[0], entry.packedSize)) {
+                fprintf(stderr, "decompress frame %zu failed\n", frame);
+                m_cached = -1;
+                return false;
+            }
+            m_cached = frame;
+            return true;
+        }
+
+        FILE* m_fp;
+        Codec m_codec;
+        Codecs m_codecs;
+        std::vector<IndexEntry> m_index;
+        //raw offset of every frame
+        std::vector<uint64_t> m_starts;
+        uint64_t m_size;
+        uint64_t m_pos;
+        int64_t m_cached;
+        std::vector<uint8_t> m_packed;
+        std::vector<uint8_t> m_raw;
+        DISALLOW_COPY_AND_ASSIGN(Reader);
+    };
+};
+
+};
+
+#endif //CompressedFrameFile_h
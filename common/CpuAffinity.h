@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CpuAffinity_h
+#define CpuAffinity_h
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace YamiMediaCodec {
+
+//Pins the calling thread to a cpu set and, when the set lives on one numa
+//node, asks the kernel to place memory the thread faults in on that node.
+//Threads created afterwards inherit both, so apply it before the pipeline
+//creates its threads and buffers.
+//spec is "node:N" or a cpu list like "0-3,8".
+//Errors go to stderr, ThreadPool and with it psnr use this without libyami.
+class CpuAffinity {
+public:
+    CpuAffinity()
+        : m_node(-1)
+    {
+        CPU_ZERO(&m_cpus);
+    }
+
+    bool parse(const char* spec)
+    {
+        CPU_ZERO(&m_cpus);
+        m_node = -1;
+        if (!spec)
+            return false;
+        if (!strncmp(spec, "node:", 5)) {
+            char* end;
+            long node = strtol(spec + 5, &end, 10);
+            if (end == spec + 5 || *end || node < 0 || node >= MAX_NODES
+                || !readNodeCpus((int)node, m_cpus)) {
+                fprintf(stderr, "invalid numa node in %s\n", spec);
+                return false;
+            }
+            m_node = (int)node;
+            return true;
+        }
+        if (!parseCpuList(spec, m_cpus) || !CPU_COUNT(&m_cpus)) {
+            fprintf(stderr, "invalid cpu list %s\n", spec);
+            return false;
+        }
+        m_node = findNode(m_cpus);
+        return true;
+    }
+
+    //node of the cpu set, -1 if it spans nodes or the system has no numa info
+    int node() const { return m_node; }
+
+    bool apply() const
+    {
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(m_cpus), &m_cpus);
+        if (err) {
+            fprintf(stderr, "set cpu affinity failed, err = %d\n", err);
+            return false;
+        }
+        if (m_node < 0)
+            return true;
+        //preferred instead of bind, we'd rather fall back than fail when the node is full
+        unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+        memset(mask, 0, sizeof(mask));
+        mask[m_node / (8 * sizeof(unsigned long))] |= 1UL << (m_node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, (unsigned long)MAX_NODES)) {
+            fprintf(stderr, "set memory policy to node %d failed\n", m_node);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const int MAX_NODES = 1024;
+    static const int MPOL_PREFERRED = 1;
+
+    //"0-3,8,10-11"
+    static bool parseCpuList(const char* list, cpu_set_t& cpus)
+    {
+        const char* p = list;
+        while (*p && *p != '\n') {
+            char* end;
+            long first = strtol(p, &end, 10);
+            if (end == p)
+                return false;
+            long last = first;
+            p = end;
+            if (*p == '-') {
+                last = strtol(p + 1, &end, 10);
+                if (end == p + 1)
+                    return false;
+                p = end;
+            }
+            if (first < 0 || last < first || last >= CPU_SETSIZE)
+                return false;
+            for (long i = first; i <= last; i++)
+                CPU_SET(i, &cpus);
+            if (*p == ',')
+                p++;
+            else if (*p && *p != '\n')
+                return false;
+        }
+        return true;
+    }
+
+    static bool readNodeCpus(int node, cpu_set_t& cpus)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* fp = fopen(path, "r");
+        if (!fp)
+            return false;
+        char list[4096];
+        bool ret = fgets(list, sizeof(list), fp) && parseCpuList(list, cpus) && CPU_COUNT(&cpus);
+        fclose(fp);
+        return ret;
+    }
+
+    static int findNode(const cpu_set_t& cpus)
+    {
+        for (int node = 0; node < MAX_NODES; node++) {
+            cpu_set_t nodeCpus;
+            CPU_ZERO(&nodeCpus);
+            if (!readNodeCpus(node, nodeCpus))
+                break;
+            cpu_set_t both;
+            CPU_AND(&both, &cpus, &nodeCpus);
+            if (CPU_EQUAL(&both, &cpus))
+                return node;
+        }
+        return -1;
+    }
+
+    cpu_set_t m_cpus;
+    int m_node;
+};
+};
+
+#endif //CpuAffinity_h
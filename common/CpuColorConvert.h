@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CpuColorConvert_h
+#define CpuColorConvert_h
+
+#include "common/ThreadPool.h"
+#include "common/log.h"
+#include <VideoCommonDefs.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+//planes of an image in host memory, in the plane order of fourcc
+struct CpuImage {
+    uint32_t fourcc;
+    uint32_t width;
+    uint32_t height;
+    uint8_t* data[3];
+    uint32_t pitch[3];
+};
+
+//Converts NV12, I420, YV12, YUY2 and P010 images to NV12, I420 or YV12 on the cpu,
+//with sse2 where we have it. P010 is ordered dithered down to 8 bits.
+//Planes are cut into row bands, which are converted in parallel
+//by the threads of a pool and the caller.
+class CpuColorConvert {
+public:
+    //threads: worker threads besides the caller, 0 converts on the caller only
+    CpuColorConvert(uint32_t threads = 0)
+    {
+        if (threads)
+            m_pool.reset(new ThreadPool(threads));
+    }
+
+    //one less than the online cpus, at most 3, so the planes of a frame go in parallel
+    static uint32_t defaultThreads()
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus <= 1)
+            return 0;
+        return cpus > 4 ? 3 : (uint32_t)cpus - 1;
+    }
+
+    static bool isSupported(uint32_t srcFourcc, uint32_t destFourcc)
+    {
+        if (!isPlanar(destFourcc) && destFourcc != YAMI_FOURCC_NV12)
+            return false;
+        switch (srcFourcc) {
+        case YAMI_FOURCC_NV12:
+        case YAMI_FOURCC_I420:
+        case YAMI_FOURCC_YV12:
+        case YAMI_FOURCC_P010:
+            return true;
+        case YAMI_FOURCC_YUY2:
+            return isPlanar(destFourcc);
+        default:
+            return false;
+        }
+    }
+
+    //fill image with a packed layout of fourcc at base, base may be NULL to get the size only.
+    //return the size in bytes, 0 if we do not know fourcc
+    static uint32_t layout(CpuImage& image, uint32_t fourcc, uint32_t width, uint32_t height, uint8_t* base)
+    {
+        uint32_t cw = (width + 1) / 2;
+        uint32_t ch = (height + 1) / 2;
+        image.fourcc = fourcc;
+        image.width = width;
+        image.height = height;
+        memset(image.data, 0, sizeof(image.data));
+        memset(image.pitch, 0, sizeof(image.pitch));
+        switch (fourcc) {
+        case YAMI_FOURCC_I420:
+        case YAMI_FOURCC_YV12:
+            image.pitch[0] = width;
+            image.pitch[1] = image.pitch[2] = cw;
+            break;
+        case YAMI_FOURCC_NV12:
+            image.pitch[0] = width;
+            image.pitch[1] = cw * 2;
+            break;
+        case YAMI_FOURCC_P010:
+            image.pitch[0] = width * 2;
+            image.pitch[1] = cw * 4;
+            break;
+        case YAMI_FOURCC_YUY2:
+            image.pitch[0] = cw * 4;
+            break;
+        default:
+            return 0;
+        }
+        image.data[0] = base;
+        uint32_t size = image.pitch[0] * height;
+        for (int i = 1; i < 3 && image.pitch[i]; i++) {
+            if (base)
+                image.data[i] = base + size;
+            size += image.pitch[i] * ch;
+        }
+        return size;
+    }
+
+    //dest and src must have the same size
+    bool convert(const CpuImage& dest, const CpuImage& src)
+    {
+        if (dest.width != src.width || dest.height != src.height) {
+            ERROR("can't scale %dx%d to %dx%d", src.width, src.height, dest.width, dest.height);
+            return false;
+        }
+        if (!isSupported(src.fourcc, dest.fourcc)) {
+            ERROR("can't convert %.4s to %.4s", (const char*)&src.fourcc, (const char*)&dest.fourcc);
+            return false;
+        }
+        m_bands.clear();
+        addBands(dest, src);
+        run();
+        return true;
+    }
+
+private:
+    struct Band;
+    typedef void (*RowFunc)(const Band& band, uint32_t y);
+
+    //rows [begin, end) of one plane operation
+    struct Band {
+        RowFunc func;
+        const uint8_t* src[2];
+        uint32_t srcPitch[2];
+        uint8_t* dest[2];
+        uint32_t destPitch[2];
+        //samples of a row
+        uint32_t width;
+        //rows of the source plane
+        uint32_t srcRows;
+        //p010 only, dither pattern advances every 1 << ditherShift samples
+        uint32_t ditherShift;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    static bool isPlanar(uint32_t fourcc)
+    {
+        return fourcc == YAMI_FOURCC_I420 || fourcc == YAMI_FOURCC_YV12;
+    }
+
+    //u and v plane index of I420 and YV12
+    static int uIndex(uint32_t fourcc) { return fourcc == YAMI_FOURCC_YV12 ? 2 : 1; }
+    static int vIndex(uint32_t fourcc) { return fourcc == YAMI_FOURCC_YV12 ? 1 : 2; }
+
+    void addBands(const CpuImage& dest, const CpuImage& src)
+    {
+        uint32_t width = src.width;
+        uint32_t height = src.height;
+        uint32_t cw = (width + 1) / 2;
+        uint32_t ch = (height + 1) / 2;
+        uint32_t fourcc = src.fourcc;
+
+        if (fourcc == YAMI_FOURCC_YUY2) {
+            add(yuy2LumaRow, src.data[0], src.pitch[0], NULL, 0, dest.data[0], dest.pitch[0], NULL, 0, width, height, height);
+            add(yuy2ChromaRow, src.data[0], src.pitch[0], NULL, 0, dest.data[uIndex(dest.fourcc)], dest.pitch[uIndex(dest.fourcc)],
+                dest.data[vIndex(dest.fourcc)], dest.pitch[vIndex(dest.fourcc)], cw, ch, height);
+            return;
+        }
+
+        bool p010 = fourcc == YAMI_FOURCC_P010;
+        add(p010 ? p010Row : copyRow, src.data[0], src.pitch[0], NULL, 0, dest.data[0], dest.pitch[0], NULL, 0,
+            width, height, height);
+
+        if (isPlanar(fourcc)) {
+            const uint8_t* u = src.data[uIndex(fourcc)];
+            const uint8_t* v = src.data[vIndex(fourcc)];
+            uint32_t uPitch = src.pitch[uIndex(fourcc)];
+            uint32_t vPitch = src.pitch[vIndex(fourcc)];
+            if (dest.fourcc == YAMI_FOURCC_NV12) {
+                add(mergeRow, u, uPitch, v, vPitch, dest.data[1], dest.pitch[1], NULL, 0, cw, ch, ch);
+                return;
+            }
+            int du = uIndex(dest.fourcc);
+            int dv = vIndex(dest.fourcc);
+            add(copyRow, u, uPitch, NULL, 0, dest.data[du], dest.pitch[du], NULL, 0, cw, ch, ch);
+            add(copyRow, v, vPitch, NULL, 0, dest.data[dv], dest.pitch[dv], NULL, 0, cw, ch, ch);
+            return;
+        }
+
+        //semi-planar source, uv interleaved
+        if (dest.fourcc == YAMI_FOURCC_NV12) {
+            //dither u and v of a pair alike
+            add(p010 ? p010Row : copyRow, src.data[1], src.pitch[1], NULL, 0, dest.data[1], dest.pitch[1], NULL, 0,
+                cw * 2, ch, ch, 1);
+            return;
+        }
+        int du = uIndex(dest.fourcc);
+        int dv = vIndex(dest.fourcc);
+        add(p010 ? p010SplitRow : splitRow, src.data[1], src.pitch[1], NULL, 0, dest.data[du], dest.pitch[du],
+            dest.data[dv], dest.pitch[dv], cw, ch, ch);
+    }
+
+    //cut the plane into one band for every thread, including the caller
+    void add(RowFunc func, const uint8_t* src0, uint32_t srcPitch0, const uint8_t* src1, uint32_t srcPitch1,
+        uint8_t* dest0, uint32_t destPitch0, uint8_t* dest1, uint32_t destPitch1,
+        uint32_t width, uint32_t rows, uint32_t srcRows, uint32_t ditherShift = 0)
+    {
+        Band band;
+        band.func = func;
+        band.src[0] = src0;
+        band.src[1] = src1;
+        band.srcPitch[0] = srcPitch0;
+        band.srcPitch[1] = srcPitch1;
+        band.dest[0] = dest0;
+        band.dest[1] = dest1;
+        band.destPitch[0] = destPitch0;
+        band.destPitch[1] = destPitch1;
+        band.width = width;
+        band.srcRows = srcRows;
+        band.ditherShift = ditherShift;
+        uint32_t parts = (m_pool ? m_pool->threads() : 0) + 1;
+        uint32_t step = (rows + parts - 1) / parts;
+        if (step < MIN_BAND_ROWS)
+            step = MIN_BAND_ROWS;
+        for (uint32_t begin = 0; begin < rows; begin += step) {
+            band.begin = begin;
+            band.end = begin + step < rows ? begin + step : rows;
+            m_bands.push_back(band);
+        }
+    }
+
+    static void process(const Band& band)
+    {
+        for (uint32_t y = band.begin; y < band.end; y++)
+            band.func(band, y);
+    }
+
+    //converts bands [first, last) of a convert
+    struct Bands {
+        explicit Bands(const std::vector<Band>& bands)
+            : bands(bands)
+        {
+        }
+        void operator()(uint32_t first, uint32_t last)
+        {
+            for (uint32_t i = first; i < last; i++)
+                process(bands[i]);
+        }
+        const std::vector<Band>& bands;
+    };
+
+    void run()
+    {
+        Bands bands(m_bands);
+        if (m_pool)
+            m_pool->parallelFor(0, m_bands.size(), 1, bands);
+        else
+            bands(0, m_bands.size());
+    }
+
+    static void copyRow(const Band& b, uint32_t y)
+    {
+        memcpy(b.dest[0] + y * b.destPitch[0], b.src[0] + y * b.srcPitch[0], b.width);
+    }
+
+    static void splitRow(const Band& b, uint32_t y)
+    {
+        split(b.src[0] + y * b.srcPitch[0], b.dest[0] + y * b.destPitch[0], b.dest[1] + y * b.destPitch[1], b.width);
+    }
+
+    static void mergeRow(const Band& b, uint32_t y)
+    {
+        const uint8_t* u = b.src[0] + y * b.srcPitch[0];
+        const uint8_t* v = b.src[1] + y * b.srcPitch[1];
+        uint8_t* uv = b.dest[0] + y * b.destPitch[0];
+        uint32_t i = 0;
+#if defined(__SSE2__)
+        for (; i + 16 <= b.width; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(u + i));
+            __m128i c = _mm_loadu_si128((const __m128i*)(v + i));
+            _mm_storeu_si128((__m128i*)(uv + i * 2), _mm_unpacklo_epi8(a, c));
+            _mm_storeu_si128((__m128i*)(uv + i * 2 + 16), _mm_unpackhi_epi8(a, c));
+        }
+#endif
+        for (; i < b.width; i++) {
+            uv[i * 2] = u[i];
+            uv[i * 2 + 1] = v[i];
+        }
+    }
+
+    static void yuy2LumaRow(const Band& b, uint32_t y)
+    {
+        const uint8_t* s = b.src[0] + y * b.srcPitch[0];
+        uint8_t* d = b.dest[0] + y * b.destPitch[0];
+        uint32_t i = 0;
+#if defined(__SSE2__)
+        const __m128i mask = _mm_set1_epi16(0xff);
+        for (; i + 16 <= b.width; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i*)(s + i * 2));
+            __m128i hi = _mm_loadu_si128((const __m128i*)(s + i * 2 + 16));
+            _mm_storeu_si128((__m128i*)(d + i), _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+        }
+#endif
+        for (; i < b.width; i++)
+            d[i] = s[i * 2];
+    }
+
+    //4:2:2 to 4:2:0, average the chroma of two source rows
+    static void yuy2ChromaRow(const Band& b, uint32_t y)
+    {
+        uint32_t y1 = y * 2 + 1 < b.srcRows ? y * 2 + 1 : y * 2;
+        const uint8_t* s0 = b.src[0] + y * 2 * b.srcPitch[0];
+        const uint8_t* s1 = b.src[0] + y1 * b.srcPitch[0];
+        uint8_t* u = b.dest[0] + y * b.destPitch[0];
+        uint8_t* v = b.dest[1] + y * b.destPitch[1];
+        uint32_t i = 0;
+#if defined(__SSE2__)
+        const __m128i mask = _mm_set1_epi16(0xff);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 8 <= b.width; i += 8) {
+            __m128i lo = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(s0 + i * 4)),
+                _mm_loadu_si128((const __m128i*)(s1 + i * 4)));
+            __m128i hi = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(s0 + i * 4 + 16)),
+                _mm_loadu_si128((const __m128i*)(s1 + i * 4 + 16)));
+            //uvuv...
+            __m128i uv = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+            _mm_storel_epi64((__m128i*)(u + i), _mm_packus_epi16(_mm_and_si128(uv, mask), zero));
+            _mm_storel_epi64((__m128i*)(v + i), _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+        }
+#endif
+        for (; i < b.width; i++) {
+            u[i] = (s0[i * 4 + 1] + s1[i * 4 + 1] + 1) >> 1;
+            v[i] = (s0[i * 4 + 3] + s1[i * 4 + 3] + 1) >> 1;
+        }
+    }
+
+    static void p010Row(const Band& b, uint32_t y)
+    {
+        p010To8(b.src[0] + y * b.srcPitch[0], b.dest[0] + y * b.destPitch[0], b.width, y, b.ditherShift);
+    }
+
+    static void p010SplitRow(const Band& b, uint32_t y)
+    {
+        const uint8_t* s = b.src[0] + y * b.srcPitch[0];
+        uint8_t* u = b.dest[0] + y * b.destPitch[0];
+        uint8_t* v = b.dest[1] + y * b.destPitch[1];
+        uint8_t uv[SPLIT_CHUNK * 2];
+        for (uint32_t i = 0; i < b.width; i += SPLIT_CHUNK) {
+            uint32_t n = b.width - i < SPLIT_CHUNK ? b.width - i : SPLIT_CHUNK;
+            p010To8(s + i * 4, uv, n * 2, y, 1);
+            split(uv, u + i, v + i, n);
+        }
+    }
+
+    static void split(const uint8_t* uv, uint8_t* u, uint8_t* v, uint32_t n)
+    {
+        uint32_t i = 0;
+#if defined(__SSE2__)
+        const __m128i mask = _mm_set1_epi16(0xff);
+        for (; i + 16 <= n; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i*)(uv + i * 2));
+            __m128i hi = _mm_loadu_si128((const __m128i*)(uv + i * 2 + 16));
+            _mm_storeu_si128((__m128i*)(u + i), _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+            _mm_storeu_si128((__m128i*)(v + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+        }
+#endif
+        for (; i < n; i++) {
+            u[i] = uv[i * 2];
+            v[i] = uv[i * 2 + 1];
+        }
+    }
+
+    //10 bits in the msb of 16, to 8 bits with a 2x2 ordered dither on the dropped bits
+    static void p010To8(const uint8_t* src, uint8_t* dest, uint32_t n, uint32_t y, uint32_t shift)
+    {
+        static const uint16_t dither[2][2] = { { 0, 2 }, { 3, 1 } };
+        const uint16_t* d = dither[y & 1];
+        uint32_t i = 0;
+#if defined(__SSE2__)
+        __m128i pattern = shift
+            ? _mm_setr_epi16(d[0], d[0], d[1], d[1], d[0], d[0], d[1], d[1])
+            : _mm_setr_epi16(d[0], d[1], d[0], d[1], d[0], d[1], d[0], d[1]);
+        for (; i + 16 <= n; i += 16) {
+            __m128i lo = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(src + i * 2)), 6);
+            __m128i hi = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(src + i * 2 + 16)), 6);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, pattern), 2);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, pattern), 2);
+            _mm_storeu_si128((__m128i*)(dest + i), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; i < n; i++) {
+            uint16_t s;
+            memcpy(&s, src + i * 2, sizeof(s));
+            uint32_t value = ((s >> 6) + d[(i >> shift) & 1]) >> 2;
+            dest[i] = value > 255 ? 255 : value;
+        }
+    }
+
+    //less is not worth a thread switch
+    static const uint32_t MIN_BAND_ROWS = 16;
+    //uv pairs of p010SplitRow per step, a multiple of 8
+    static const uint32_t SPLIT_CHUNK = 256;
+
+    //NULL converts on the caller only
+    SharedPtr<ThreadPool> m_pool;
+    //bands of the current convert
+    std::vector<Band> m_bands;
+    DISALLOW_COPY_AND_ASSIGN(CpuColorConvert);
+};
+};
+
+#endif //CpuColorConvert_h
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EncoderDrain_h
+#define EncoderDrain_h
+
+#include "common/NonCopyable.h"
+#include "common/Pipeline.h"
+#include "common/condition.h"
+#include "common/lock.h"
+#include <Yami.h>
+
+#include <stdint.h>
+
+namespace YamiMediaCodec {
+
+//Lets one thread submit frames to an encoder while another one takes the
+//bitstream out, so the encoder keeps several frames in flight instead of
+//waiting for the file write of the last one.
+//It is the "queue" between a submit stage and a drain stage of a Pipeline:
+//close() after the last frame flushes the encoder, cancel() wakes both sides.
+class EncoderDrain : public Pipeline::QueueBase {
+public:
+    explicit EncoderDrain(IVideoEncoder* encoder)
+        : m_encoder(encoder)
+        , m_cond(m_lock)
+        , m_submitted(0)
+        , m_retrieved(0)
+        , m_closed(false)
+        , m_cancelled(false)
+    {
+    }
+
+    //submit side, input is a VideoFrameRawData* or a SharedPtr<VideoFrame>.
+    //while the encoder holds as many frames as it can, wait for the drain side
+    template <class Input>
+    Encode_Status encode(const Input& input)
+    {
+        while (1) {
+            uint64_t retrieved;
+            {
+                AutoLock lock(m_lock);
+                if (m_cancelled)
+                    return ENCODE_FAIL;
+                retrieved = m_retrieved;
+            }
+            Encode_Status status = m_encoder->encode(input);
+            AutoLock lock(m_lock);
+            if (status != ENCODE_IS_BUSY) {
+                if (status == ENCODE_SUCCESS) {
+                    m_submitted++;
+                    m_cond.broadcast();
+                }
+                return status;
+            }
+            while (m_retrieved == retrieved && !m_cancelled)
+                m_cond.wait();
+        }
+    }
+
+    //drain side, blocks till the oldest frame in flight is encoded.
+    //ENCODE_BUFFER_NO_MORE after the last frame or if cancelled,
+    //ENCODE_BUFFER_TOO_SMALL asks for a bigger buffer and a retry
+    Encode_Status getOutput(VideoEncOutputBuffer* outBuffer, VideoEncMVBuffer* mvBuffer = NULL)
+    {
+        while (1) {
+            uint64_t submitted;
+            bool closed;
+            {
+                AutoLock lock(m_lock);
+                if (m_cancelled)
+                    return ENCODE_BUFFER_NO_MORE;
+                submitted = m_submitted;
+                closed = m_closed;
+            }
+            Encode_Status status = mvBuffer ? m_encoder->getOutput(outBuffer, mvBuffer, true)
+                                            : m_encoder->getOutput(outBuffer, true);
+            AutoLock lock(m_lock);
+            if (status != ENCODE_BUFFER_NO_MORE) {
+                if (status == ENCODE_SUCCESS) {
+                    m_retrieved++;
+                    m_cond.broadcast();
+                }
+                return status;
+            }
+            //the encoder was flushed before closed was set, so nothing is left
+            if (closed)
+                return ENCODE_BUFFER_NO_MORE;
+            //nothing ready yet, the encoder may hold frames back for reordering
+            while (m_submitted == submitted && !m_closed && !m_cancelled)
+                m_cond.wait();
+        }
+    }
+
+    //submit side, no more frames, flush the encoder
+    void close()
+    {
+        AutoLock lock(m_lock);
+        if (!m_cancelled)
+            m_encoder->flush();
+        m_closed = true;
+        m_cond.broadcast();
+    }
+
+    void cancel()
+    {
+        AutoLock lock(m_lock);
+        m_cancelled = true;
+        m_cond.broadcast();
+    }
+
+private:
+    IVideoEncoder* m_encoder;
+    Lock m_lock;
+    Condition m_cond;
+    uint64_t m_submitted;
+    uint64_t m_retrieved;
+    bool m_closed;
+    bool m_cancelled;
+    DISALLOW_COPY_AND_ASSIGN(EncoderDrain);
+};
+};
+
+#endif //EncoderDrain_h
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FrameDigest_h
+#define FrameDigest_h
+
+#include "common/NonCopyable.h"
+#include <VideoCommonDefs.h>
+
+#if __ENABLE_MD5__
+// see decodeoutput.cpp, bsd/md5.h produces a warning with __bounded__ attribute
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#include <bsd/md5.h>
+#pragma GCC diagnostic pop
+#endif
+
+#ifdef __ENABLE_XXHASH__
+#include <xxhash.h>
+#endif
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+namespace YamiMediaCodec {
+
+//streaming digest of frame bytes
+class FrameDigest {
+public:
+    //"md5", "xxh3" or "crc32c", return NULL if unknown or not built in
+    static SharedPtr<FrameDigest> create(const char* name);
+    //md5 if we have it
+    static const char* defaultName();
+
+    virtual ~FrameDigest() {}
+    virtual const char* name() const = 0;
+    virtual void reset() = 0;
+    virtual void update(const uint8_t* data, size_t size) = 0;
+    //hex string of the digest, call reset() before next use
+    virtual std::string final() = 0;
+};
+
+#if __ENABLE_MD5__
+class MD5Digest : public FrameDigest {
+public:
+    MD5Digest() { reset(); }
+    const char* name() const { return "md5"; }
+    void reset() { MD5Init(&m_ctx); }
+    void update(const uint8_t* data, size_t size) { MD5Update(&m_ctx, data, size); }
+    std::string final()
+    {
+        uint8_t result[16];
+        char hex[33];
+        MD5Final(result, &m_ctx);
+        for (uint32_t i = 0; i < 16; i++)
+            snprintf(hex + i * 2, 3, "%02x", (uint32_t)result[i]);
+        return hex;
+    }
+
+private:
+    MD5_CTX m_ctx;
+};
+#endif
+
+#ifdef __ENABLE_XXHASH__
+class XXH3Digest : public FrameDigest {
+public:
+    XXH3Digest()
+        : m_state(XXH3_createState())
+    {
+        reset();
+    }
+    ~XXH3Digest() { XXH3_freeState(m_state); }
+    const char* name() const { return "xxh3"; }
+    void reset() { XXH3_64bits_reset(m_state); }
+    void update(const uint8_t* data, size_t size) { XXH3_64bits_update(m_state, data, size); }
+    std::string final()
+    {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)XXH3_64bits_digest(m_state));
+        return hex;
+    }
+
+private:
+    XXH3_state_t* m_state;
+    DISALLOW_COPY_AND_ASSIGN(XXH3Digest);
+};
+#endif
+
+//crc32c (castagnoli), uses the sse4.2 crc32 instruction when the cpu has it
+class CRC32CDigest : public FrameDigest {
+public:
+    CRC32CDigest()
+        : m_hardware(hasHardware())
+    {
+        reset();
+    }
+    const char* name() const { return "crc32c"; }
+    void reset() { m_crc = 0xffffffff; }
+    void update(const uint8_t* data, size_t size)
+    {
+#if defined(__x86_64__)
+        if (m_hardware) {
+            m_crc = updateHardware(m_crc, data, size);
+            return;
+        }
+#endif
+        const uint32_t* t = table();
+        for (size_t i = 0; i < size; i++)
+            m_crc = t[(m_crc ^ data[i]) & 0xff] ^ (m_crc >> 8);
+    }
+    std::string final()
+    {
+        char hex[9];
+        snprintf(hex, sizeof(hex), "%08x", m_crc ^ 0xffffffff);
+        return hex;
+    }
+
+private:
+    static bool hasHardware()
+    {
+#if defined(__x86_64__)
+        return __builtin_cpu_supports("sse4.2");
+#else
+        return false;
+#endif
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2"))) static uint32_t updateHardware(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        uint64_t crc64 = crc;
+        for (; size >= 8; size -= 8, data += 8) {
+            uint64_t v;
+            memcpy(&v, data, sizeof(v));
+            crc64 = _mm_crc32_u64(crc64, v);
+        }
+        crc = (uint32_t)crc64;
+        for (; size; size--, data++)
+            crc = _mm_crc32_u8(crc, *data);
+        return crc;
+    }
+#endif
+
+    static const uint32_t* table()
+    {
+        static CRCTable t;
+        return t.entries;
+    }
+
+    struct CRCTable {
+        CRCTable()
+        {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int j = 0; j < 8; j++)
+                    crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+                entries[i] = crc;
+            }
+        }
+        uint32_t entries[256];
+    };
+
+    bool m_hardware;
+    uint32_t m_crc;
+};
+
+inline SharedPtr<FrameDigest> FrameDigest::create(const char* name)
+{
+    SharedPtr<FrameDigest> digest;
+    if (!name)
+        name = defaultName();
+#if __ENABLE_MD5__
+    if (!strcasecmp(name, "md5"))
+        digest.reset(new MD5Digest);
+#endif
+#ifdef __ENABLE_XXHASH__
+    if (!strcasecmp(name, "xxh3"))
+        digest.reset(new XXH3Digest);
+#endif
+    if (!strcasecmp(name, "crc32c"))
+        digest.reset(new CRC32CDigest);
+    return digest;
+}
+
+inline const char* FrameDigest::defaultName()
+{
+#if __ENABLE_MD5__
+    return "md5";
+#else
+    return "crc32c";
+#endif
+}
+};
+
+#endif //FrameDigest_h
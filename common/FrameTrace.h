@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FrameTrace_h
+#define FrameTrace_h
+
+#include "common/NonCopyable.h"
+#include "common/PoolStats.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+//Where frames spend their time. Stages stamp a frame id when the frame passes
+//one of the points, a side table keeps the stamps of the frames in flight.
+//When a frame reaches the last point, the time since each earlier stamped point
+//and the whole way through go to histograms. No lock, a stamp is a clock read and
+//two stores, so it can stay on.
+//One thread stamps each point, a frame is handed from one point to the next
+//through queues or locks, so the last point sees the earlier stamps.
+//A frame carrying its id in its own timestamp field leaves that timestamp with
+//save() and gets it back from restore().
+class FrameTrace {
+public:
+    //names of the points in the order frames pass them, points may be skipped
+    explicit FrameTrace(const std::vector<std::string>& points)
+        : m_points(points)
+        , m_histograms(points.size())
+        , m_sinceFirst(points.size())
+        , m_frames(0)
+        , m_lost(0)
+    {
+        for (uint32_t i = 0; i < SLOTS; i++) {
+            m_slots[i].id = -1;
+            m_slots[i].timeStamp = 0;
+            m_slots[i].stamps.resize(points.size());
+        }
+    }
+
+    //the frame passes point now, the first point starts a frame
+    void stamp(int64_t id, uint32_t point)
+    {
+        Slot& slot = m_slots[(uint64_t)id % SLOTS];
+        uint64_t now = getMonotonicTimeUs();
+        if (!point) {
+            for (size_t i = 1; i < slot.stamps.size(); i++)
+                store(slot.stamps[i], 0);
+            store(slot.stamps[0], now);
+            __atomic_store_n(&slot.id, id, __ATOMIC_RELEASE);
+            return;
+        }
+        if (__atomic_load_n(&slot.id, __ATOMIC_ACQUIRE) != id)
+            return;
+        store(slot.stamps[point], now);
+        if (point == m_points.size() - 1)
+            finish(slot, id);
+    }
+
+    //keeps the timeStamp of a started frame while its id takes the place
+    void save(int64_t id, int64_t timeStamp)
+    {
+        Slot& slot = m_slots[(uint64_t)id % SLOTS];
+        if (__atomic_load_n(&slot.id, __ATOMIC_ACQUIRE) == id)
+            __atomic_store_n(&slot.timeStamp, timeStamp, __ATOMIC_RELEASE);
+    }
+
+    //the timeStamp saved for id, false if the slot was reused meanwhile
+    bool restore(int64_t id, int64_t& timeStamp) const
+    {
+        const Slot& slot = m_slots[(uint64_t)id % SLOTS];
+        int64_t saved = __atomic_load_n(&slot.timeStamp, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot.id, __ATOMIC_ACQUIRE) != id)
+            return false;
+        timeStamp = saved;
+        return true;
+    }
+
+    //a table of latencies in milliseconds, printed at once
+    void report(const std::string& name) const
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "%s latency of %llu frames, ms (%llu lost):\n    %-10s %9s %9s %9s %9s\n",
+            name.c_str(), (unsigned long long)m_frames, (unsigned long long)m_lost, "to", "p50", "p95", "p99", "max");
+        std::string report(line);
+        for (size_t i = 1; i < m_histograms.size(); i++)
+            report += row(m_points[i], m_histograms[i]);
+        report += row("total", m_histograms[0]);
+        fputs(report.c_str(), stdout);
+    }
+
+    //"p50 x p95 x p99 x max x ms" from the first point to point
+    std::string latency(uint32_t point) const
+    {
+        const TimeHistogram& histogram = m_sinceFirst[point];
+        if (!histogram.count())
+            return "no frames";
+        char line[128];
+        snprintf(line, sizeof(line), "p50 %.3f p95 %.3f p99 %.3f max %.3f ms",
+            histogram.percentile(50) / 1000.0, histogram.percentile(95) / 1000.0,
+            histogram.percentile(99) / 1000.0, histogram.max() / 1000.0);
+        return line;
+    }
+
+private:
+    struct Slot {
+        int64_t id;
+        //of the frame, from save()
+        int64_t timeStamp;
+        //microseconds, 0 if the frame did not pass the point
+        std::vector<uint64_t> stamps;
+    };
+
+    static void store(uint64_t& stamp, uint64_t value) { __atomic_store_n(&stamp, value, __ATOMIC_RELAXED); }
+    static uint64_t load(const uint64_t& stamp) { return __atomic_load_n(&stamp, __ATOMIC_RELAXED); }
+
+    //the frame is at the last point, only its thread gets here
+    void finish(Slot& slot, int64_t id)
+    {
+        std::vector<uint64_t> stamps(slot.stamps.size());
+        for (size_t i = 0; i < stamps.size(); i++)
+            stamps[i] = load(slot.stamps[i]);
+        //more frames in flight than slots, the first point reused it meanwhile
+        if (__atomic_load_n(&slot.id, __ATOMIC_ACQUIRE) != id) {
+            m_lost++;
+            return;
+        }
+        uint64_t last = stamps[0];
+        for (size_t i = 1; i < stamps.size(); i++) {
+            if (!stamps[i])
+                continue;
+            //a point may be stamped just before the frame is handed on, the
+            //next one can land in the same microsecond or, on another cpu, before it
+            uint64_t at = std::max(stamps[i], last);
+            m_histograms[i].add(at - last);
+            m_sinceFirst[i].add(at - stamps[0]);
+            last = at;
+        }
+        m_histograms[0].add(last - stamps[0]);
+        m_frames++;
+    }
+
+    static std::string row(const std::string& name, const TimeHistogram& histogram)
+    {
+        char line[128];
+        if (!histogram.count())
+            return std::string();
+        snprintf(line, sizeof(line), "    %-10s %9.3f %9.3f %9.3f %9.3f\n", name.c_str(),
+            histogram.percentile(50) / 1000.0, histogram.percentile(95) / 1000.0,
+            histogram.percentile(99) / 1000.0, histogram.max() / 1000.0);
+        return line;
+    }
+
+    //more than the frames a pipeline holds, queues and pools included
+    static const uint32_t SLOTS = 256;
+
+    std::vector<std::string> m_points;
+    Slot m_slots[SLOTS];
+    //0 is from the first point to the last stamped one, i is from the point before i
+    std::vector<TimeHistogram> m_histograms;
+    //i is from the first point to i
+    std::vector<TimeHistogram> m_sinceFirst;
+    uint64_t m_frames;
+    uint64_t m_lost;
+    DISALLOW_COPY_AND_ASSIGN(FrameTrace);
+};
+};
+
+#endif //FrameTrace_h
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MappedFrameAllocator_h
+#define MappedFrameAllocator_h
+
+#include "common/NonCopyable.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/PooledFrameAllocator.h"
+#include "common/VaapiUtils.h"
+#include "common/videopool.h"
+#include <VideoCommonDefs.h>
+
+#include <deque>
+#include <map>
+#include <va/va.h>
+
+namespace YamiMediaCodec {
+
+//Va frames that keep their derived image mapped while they cycle through the pool.
+//Each pool entry derives and maps its surface the first time the cpu touches it,
+//later uses only sync the surface, so a pool of n surfaces is mapped n times
+//instead of once per frame.
+//The mapping belongs to the pool entry, not to the surface id. setFormat() drops
+//the pool, and an entry unmaps once its pool is gone and its frame is back,
+//before the surface under it is returned. Frames from anywhere else, like
+//decoder surfaces, are not found by map() and get mapped per frame by the caller.
+class MappedFrameAllocator : public FrameAllocator {
+public:
+    MappedFrameAllocator(const SharedPtr<VADisplay>& display, int poolsize)
+        : m_display(display)
+        , m_allocator(new PooledFrameAllocator(display, poolsize))
+        , m_poolsize(poolsize)
+    {
+    }
+
+    bool setFormat(uint32_t fourcc, int width, int height)
+    {
+        //frames still out keep the old pool, and their mappings, until they are back
+        m_pool.reset();
+        if (!m_allocator->setFormat(fourcc, width, height))
+            return false;
+        std::deque<SharedPtr<Entry> > entries;
+        SharedPtr<VideoFrame> surface;
+        while ((int)entries.size() < m_poolsize && (surface = m_allocator->alloc()))
+            entries.push_back(SharedPtr<Entry>(new Entry(m_display, surface)));
+        if (entries.empty()) {
+            ERROR("no surface for %.4s %dx%d", (char*)&fourcc, width, height);
+            return false;
+        }
+        m_pool.reset(new VideoPool<Entry>(entries));
+        return true;
+    }
+
+    SharedPtr<VideoFrame> alloc()
+    {
+        SharedPtr<VideoFrame> frame;
+        if (!m_pool)
+            return frame;
+        SharedPtr<Entry> entry = m_pool->alloc();
+        if (entry) {
+            entry->reset();
+            frame = entry;
+        }
+        return frame;
+    }
+
+    //the mapped derived image of frame, synced for the cpu. valid while frame is held.
+    //NULL if frame is not from a MappedFrameAllocator, or on failure
+    static uint8_t* map(const SharedPtr<VideoFrame>& frame, VAImage& image)
+    {
+        Entry* entry = Entry::find(frame.get());
+        return entry ? entry->map(image) : NULL;
+    }
+
+private:
+    //a frame of the pool, it holds a surface of m_allocator
+    class Entry : public VideoFrame {
+    public:
+        Entry(const SharedPtr<VADisplay>& display, const SharedPtr<VideoFrame>& surface)
+            : m_display(display)
+            , m_surface(surface)
+            , m_data(NULL)
+        {
+            reset();
+            Registry& registry = Entry::registry();
+            AutoLock _l(registry.lock);
+            registry.entries[this] = this;
+        }
+
+        ~Entry()
+        {
+            {
+                Registry& registry = Entry::registry();
+                AutoLock _l(registry.lock);
+                registry.entries.erase(this);
+            }
+            if (m_data)
+                unmapImage(*m_display, m_image);
+        }
+
+        //the frame as the pool below handed it out
+        void reset()
+        {
+            *static_cast<VideoFrame*>(this) = *m_surface;
+        }
+
+        uint8_t* map(VAImage& image)
+        {
+            AutoLock _l(m_lock);
+            if (!m_data) {
+                m_data = mapSurfaceToImage(*m_display, m_surface->surface, m_image);
+                if (!m_data)
+                    return NULL;
+            }
+            else {
+                //vaMapBuffer waited for the gpu the first time, a kept mapping has to wait itself
+                VAStatus status = vaSyncSurface(*m_display, (VASurfaceID)m_surface->surface);
+                if (!checkVaapiStatus(status, "vaSyncSurface"))
+                    return NULL;
+            }
+            image = m_image;
+            return m_data;
+        }
+
+        static Entry* find(const VideoFrame* frame)
+        {
+            Registry& registry = Entry::registry();
+            AutoLock _l(registry.lock);
+            std::map<const VideoFrame*, Entry*>::iterator it = registry.entries.find(frame);
+            return it == registry.entries.end() ? NULL : it->second;
+        }
+
+    private:
+        //live entries of all pools
+        struct Registry {
+            Lock lock;
+            std::map<const VideoFrame*, Entry*> entries;
+        };
+        //never destroyed, a pool may go after the exit handlers
+        static Registry& registry()
+        {
+            static Registry* registry = new Registry;
+            return *registry;
+        }
+
+        SharedPtr<VADisplay> m_display;
+        SharedPtr<VideoFrame> m_surface;
+        Lock m_lock;
+        VAImage m_image;
+        uint8_t* m_data;
+        DISALLOW_COPY_AND_ASSIGN(Entry);
+    };
+
+    SharedPtr<VADisplay> m_display;
+    SharedPtr<FrameAllocator> m_allocator;
+    SharedPtr<VideoPool<Entry> > m_pool;
+    int m_poolsize;
+    DISALLOW_COPY_AND_ASSIGN(MappedFrameAllocator);
+};
+};
+
+#endif //MappedFrameAllocator_h
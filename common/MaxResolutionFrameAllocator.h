@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MaxResolutionFrameAllocator_h
+#define MaxResolutionFrameAllocator_h
+
+#include "common/log.h"
+#include "common/PooledFrameAllocator.h"
+#include <VideoCommonDefs.h>
+
+#include <algorithm>
+
+namespace YamiMediaCodec {
+
+//Reserves frames at a known maximum resolution.
+//setFormat() with a smaller size only changes the crop of the frames handed
+//out later, so a resolution change does not reallocate the pool.
+//We only reallocate for a new fourcc or a size larger than the maximum.
+class MaxResolutionFrameAllocator : public FrameAllocator {
+public:
+    MaxResolutionFrameAllocator(const SharedPtr<FrameAllocator>& allocator, int maxWidth, int maxHeight)
+        : m_allocator(allocator)
+        , m_maxWidth(maxWidth)
+        , m_maxHeight(maxHeight)
+        , m_fourcc(0)
+        , m_width(0)
+        , m_height(0)
+    {
+    }
+
+    bool setFormat(uint32_t fourcc, int width, int height)
+    {
+        bool grow = width > m_maxWidth || height > m_maxHeight;
+        if (grow) {
+            ERROR("%dx%d exceeds max resolution %dx%d, reallocate", width, height, m_maxWidth, m_maxHeight);
+            m_maxWidth = std::max(width, m_maxWidth);
+            m_maxHeight = std::max(height, m_maxHeight);
+        }
+        if (grow || fourcc != m_fourcc) {
+            if (!m_allocator->setFormat(fourcc, m_maxWidth, m_maxHeight))
+                return false;
+            m_fourcc = fourcc;
+        }
+        m_width = width;
+        m_height = height;
+        return true;
+    }
+
+    SharedPtr<VideoFrame> alloc()
+    {
+        SharedPtr<VideoFrame> frame = m_allocator->alloc();
+        if (frame) {
+            frame->crop.x = 0;
+            frame->crop.y = 0;
+            frame->crop.width = m_width;
+            frame->crop.height = m_height;
+        }
+        return frame;
+    }
+
+private:
+    SharedPtr<FrameAllocator> m_allocator;
+    int m_maxWidth;
+    int m_maxHeight;
+    uint32_t m_fourcc;
+    int m_width;
+    int m_height;
+};
+
+//wrap allocator with MaxResolutionFrameAllocator if the max resolution is known
+inline SharedPtr<FrameAllocator> reserveMaxResolution(const SharedPtr<FrameAllocator>& allocator,
+    int maxWidth, int maxHeight)
+{
+    if (!allocator || maxWidth <= 0 || maxHeight <= 0)
+        return allocator;
+    SharedPtr<FrameAllocator> reserved(new MaxResolutionFrameAllocator(allocator, maxWidth, maxHeight));
+    return reserved;
+}
+};
+
+#endif //MaxResolutionFrameAllocator_h
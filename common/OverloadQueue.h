@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OverloadQueue_h
+#define OverloadQueue_h
+
+#include "common/NonCopyable.h"
+#include "common/condition.h"
+#include "common/lock.h"
+
+#include <deque>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+//what a queue does when its consumer lags behind a live source
+struct OverloadPolicy {
+    enum Mode {
+        //the producer waits, nothing is lost, for files
+        BLOCK,
+        //the waiting items make room for the new one
+        DROP_OLDEST,
+        //the new item is dropped
+        DROP_NEWEST,
+        //only the new item waits, all others are dropped, depth and age do not matter
+        KEEP_LATEST,
+        //every other new item is dropped, the rate halves evenly instead of in bursts
+        HALVE
+    };
+
+    OverloadPolicy()
+        : mode(BLOCK)
+        , depth(0)
+        , ageMs(0)
+    {
+    }
+
+    //oldest, newest, latest or halve
+    bool parse(const char* name)
+    {
+        for (int i = DROP_OLDEST; i <= HALVE; i++) {
+            if (!strcmp(name, names()[i])) {
+                mode = (Mode)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char* name() const { return names()[mode]; }
+
+    Mode mode;
+    //overloaded with this many items waiting, 0 for the capacity of the queue
+    uint32_t depth;
+    //or once the oldest one waited this long, 0 for no limit
+    uint32_t ageMs;
+
+private:
+    static const char* const* names()
+    {
+        static const char* const names[] = { "block", "oldest", "newest", "latest", "halve" };
+        return names;
+    }
+};
+
+//A bounded queue whose push() never waits. When the consumer lags, the policy
+//decides which items are dropped, so the latency of a live source stays bounded.
+//Dropped items are released at once, frames go back to their pool.
+template <class T>
+class OverloadQueue {
+public:
+    OverloadQueue(uint32_t capacity, const OverloadPolicy& policy)
+        : m_cond(m_lock)
+        , m_capacity(capacity ? capacity : 1)
+        , m_policy(policy)
+        , m_skip(false)
+        , m_closed(false)
+        , m_cancelled(false)
+        , m_pushed(0)
+        , m_dropped(0)
+    {
+        if (!m_policy.depth || m_policy.depth > m_capacity)
+            m_policy.depth = m_capacity;
+    }
+
+    //producer side, false if cancelled. a dropped item is not an error
+    bool push(const T& item)
+    {
+        //released after the lock
+        std::vector<T> dropped;
+        AutoLock lock(m_lock);
+        if (m_cancelled)
+            return false;
+        m_pushed++;
+        uint64_t now = nowUs();
+        bool drop = false;
+        switch (m_policy.mode) {
+        case OverloadPolicy::DROP_OLDEST:
+            while (overloaded(now)) {
+                dropped.push_back(m_items.front().item);
+                m_items.pop_front();
+            }
+            break;
+        case OverloadPolicy::KEEP_LATEST:
+            for (size_t i = 0; i < m_items.size(); i++)
+                dropped.push_back(m_items[i].item);
+            m_items.clear();
+            break;
+        case OverloadPolicy::HALVE:
+            m_skip = overloaded(now) && !m_skip;
+            drop = m_skip || m_items.size() >= m_capacity;
+            break;
+        default:
+            drop = overloaded(now);
+            break;
+        }
+        m_dropped += dropped.size() + drop;
+        if (!drop) {
+            Entry entry = { item, now };
+            m_items.push_back(entry);
+            m_cond.signal();
+        }
+        return true;
+    }
+
+    //consumer side, blocks while empty, false on eos or if cancelled
+    bool pop(T& item)
+    {
+        AutoLock lock(m_lock);
+        while (m_items.empty() && !m_closed && !m_cancelled)
+            m_cond.wait();
+        if (m_cancelled || m_items.empty())
+            return false;
+        item = m_items.front().item;
+        m_items.pop_front();
+        return true;
+    }
+
+    //producer side, no more items
+    void close()
+    {
+        AutoLock lock(m_lock);
+        m_closed = true;
+        m_cond.broadcast();
+    }
+
+    void cancel()
+    {
+        AutoLock lock(m_lock);
+        m_cancelled = true;
+        m_cond.broadcast();
+    }
+
+    const OverloadPolicy& policy() const { return m_policy; }
+
+    uint64_t pushed()
+    {
+        AutoLock lock(m_lock);
+        return m_pushed;
+    }
+
+    uint64_t dropped()
+    {
+        AutoLock lock(m_lock);
+        return m_dropped;
+    }
+
+private:
+    struct Entry {
+        T item;
+        uint64_t time;
+    };
+
+    static uint64_t nowUs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    //too many items wait, or the oldest one waited too long
+    bool overloaded(uint64_t now) const
+    {
+        if (m_items.empty())
+            return false;
+        if (m_items.size() >= m_policy.depth)
+            return true;
+        return m_policy.ageMs && now - m_items.front().time >= m_policy.ageMs * 1000ULL;
+    }
+
+    Lock m_lock;
+    Condition m_cond;
+    std::deque<Entry> m_items;
+    uint32_t m_capacity;
+    OverloadPolicy m_policy;
+    //halve dropped the last item
+    bool m_skip;
+    bool m_closed;
+    bool m_cancelled;
+    uint64_t m_pushed;
+    uint64_t m_dropped;
+    DISALLOW_COPY_AND_ASSIGN(OverloadQueue);
+};
+};
+
+#endif //OverloadQueue_h
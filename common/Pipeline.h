@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef Pipeline_h
+#define Pipeline_h
+
+#include "common/NonCopyable.h"
+#include "common/OverloadQueue.h"
+#include "common/SpscQueue.h"
+#include "common/condition.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include <VideoCommonDefs.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+//Caps the stage threads of all pipelines in the process, so many jobs don't start
+//more blocking threads than the cpus and the gpu engines can serve. A pipeline takes
+//the threads of all its stages at once, it never runs some stages while the others
+//wait for threads. Pipelines get threads in the order they asked, so a large one is not
+//starved by small ones, and one larger than the cap runs when no other one does.
+class StageThreadLimit {
+public:
+    static StageThreadLimit& instance()
+    {
+        static StageThreadLimit limit;
+        return limit;
+    }
+
+    //0 for no cap
+    void setLimit(uint32_t limit)
+    {
+        AutoLock lock(m_lock);
+        m_limit = limit;
+        m_cond.broadcast();
+    }
+
+    //blocks till threads are free and the pipelines that asked before us have theirs
+    void acquire(uint32_t threads)
+    {
+        AutoLock lock(m_lock);
+        uint64_t ticket = m_tickets++;
+        while (ticket != m_serving || (m_limit && m_used && m_used + threads > m_limit))
+            m_cond.wait();
+        m_serving++;
+        m_used += threads;
+        m_cond.broadcast();
+    }
+
+    void release(uint32_t threads)
+    {
+        AutoLock lock(m_lock);
+        m_used -= threads;
+        m_cond.broadcast();
+    }
+
+private:
+    StageThreadLimit()
+        : m_cond(m_lock)
+        , m_limit(0)
+        , m_used(0)
+        , m_tickets(0)
+        , m_serving(0)
+    {
+    }
+
+    Lock m_lock;
+    Condition m_cond;
+    uint32_t m_limit;
+    uint32_t m_used;
+    uint64_t m_tickets;
+    uint64_t m_serving;
+    DISALLOW_COPY_AND_ASSIGN(StageThreadLimit);
+};
+
+//Stages run on their own threads and hand items down through bounded queues.
+//When a stage returns, its output queue is closed, so the next stage sees eos
+//after the queued items and can flush. When a stage fails, all queues are
+//cancelled and every stage returns as soon as it touches one.
+class Pipeline {
+public:
+    class QueueBase {
+    public:
+        virtual ~QueueBase() {}
+        //no more items, pop() fails once the queued ones are taken
+        virtual void close() = 0;
+        //wake up everyone and fail all calls from now on
+        virtual void cancel() = 0;
+        //a line for the report, empty if there is nothing to tell
+        virtual std::string stats() { return std::string(); }
+    };
+
+    //one stage pushes and one stage pops each queue, so a lock-free ring does.
+    //with an overload policy push() never waits, the policy drops items instead
+    template <class T>
+    class Queue : public QueueBase {
+    public:
+        explicit Queue(uint32_t capacity, const OverloadPolicy& overload = OverloadPolicy())
+            : m_ring(capacity)
+        {
+            if (overload.mode != OverloadPolicy::BLOCK)
+                m_overload.reset(new OverloadQueue<T>(capacity, overload));
+        }
+
+        //blocks while full, false if cancelled
+        bool push(const T& item) { return m_overload ? m_overload->push(item) : m_ring.push(item); }
+        //blocks while empty, false on eos or if cancelled
+        bool pop(T& item) { return m_overload ? m_overload->pop(item) : m_ring.pop(item); }
+
+        void close()
+        {
+            if (m_overload)
+                m_overload->close();
+            else
+                m_ring.close();
+        }
+
+        void cancel()
+        {
+            if (m_overload)
+                m_overload->cancel();
+            else
+                m_ring.cancel();
+        }
+
+        std::string stats()
+        {
+            if (!m_overload)
+                return std::string();
+            const OverloadPolicy& policy = m_overload->policy();
+            char line[128];
+            snprintf(line, sizeof(line), "dropped %llu of %llu items, %s at depth %u or age %u ms",
+                (unsigned long long)m_overload->dropped(), (unsigned long long)m_overload->pushed(),
+                policy.name(), policy.depth, policy.ageMs);
+            return line;
+        }
+
+    private:
+        SpscQueue<T> m_ring;
+        SharedPtr<OverloadQueue<T> > m_overload;
+        DISALLOW_COPY_AND_ASSIGN(Queue);
+    };
+
+    class Stage {
+    public:
+        explicit Stage(const char* name)
+            : m_name(name)
+            , m_pipeline(NULL)
+            , m_items(0)
+            , m_waited(0)
+            , m_elapsed(0)
+            , m_cpu(0)
+        {
+        }
+        virtual ~Stage() {}
+        const char* name() const { return m_name; }
+        //may be read while the stage runs, for progress
+        uint64_t items() const { return __atomic_load_n(&m_items, __ATOMIC_RELAXED); }
+        //work until the input ends, false on error
+        virtual bool run() = 0;
+
+    protected:
+        //these count the time we are blocked, so the report tells busy from starved
+        template <class T>
+        bool pop(Queue<T>& queue, T& item)
+        {
+            uint64_t start = now();
+            bool ret = queue.pop(item);
+            m_waited += now() - start;
+            return ret;
+        }
+        template <class T>
+        bool push(Queue<T>& queue, const T& item)
+        {
+            uint64_t start = now();
+            bool ret = queue.push(item);
+            m_waited += now() - start;
+            return ret;
+        }
+        //one more item done, for the throughput report
+        void addItem() { __atomic_add_fetch(&m_items, 1, __ATOMIC_RELAXED); }
+        //pop() failed because another stage failed, not because of eos
+        bool cancelled() const { return m_pipeline->cancelled(); }
+
+    private:
+        friend class Pipeline;
+        const char* m_name;
+        Pipeline* m_pipeline;
+        uint64_t m_items;
+        uint64_t m_waited;
+        uint64_t m_elapsed;
+        //cpu time of the stage thread
+        uint64_t m_cpu;
+        DISALLOW_COPY_AND_ASSIGN(Stage);
+    };
+
+    //name heads the report
+    explicit Pipeline(const std::string& name = "pipeline")
+        : m_name(name)
+        , m_cancelled(false)
+        , m_queued(0)
+    {
+    }
+
+    template <class T>
+    SharedPtr<Queue<T> > createQueue(uint32_t capacity, const OverloadPolicy& overload = OverloadPolicy())
+    {
+        SharedPtr<Queue<T> > queue(new Queue<T>(capacity, overload));
+        addQueue(queue);
+        return queue;
+    }
+
+    //anything else stages block on, cancel() cancels it with the queues
+    void addQueue(const SharedPtr<QueueBase>& queue)
+    {
+        m_queues.push_back(queue);
+    }
+
+    //stages run in the order they are added, output is closed when the stage returns
+    void add(const SharedPtr<Stage>& stage, const SharedPtr<QueueBase>& output = SharedPtr<QueueBase>())
+    {
+        std::vector<SharedPtr<QueueBase> > outputs;
+        if (output)
+            outputs.push_back(output);
+        add(stage, outputs);
+    }
+
+    //a stage feeding several others
+    void add(const SharedPtr<Stage>& stage, const std::vector<SharedPtr<QueueBase> >& outputs)
+    {
+        Node node;
+        node.stage = stage;
+        node.outputs = outputs;
+        node.pipeline = this;
+        stage->m_pipeline = this;
+        m_nodes.push_back(node);
+    }
+
+    //run all stages till they return, false if any of them failed.
+    //waits for StageThreadLimit to give us a thread for each stage first
+    bool run()
+    {
+        uint64_t start = now();
+        StageThreadLimit::instance().acquire(m_nodes.size());
+        m_queued = now() - start;
+        start += m_queued;
+        std::vector<pthread_t> threads;
+        for (size_t i = 0; i < m_nodes.size(); i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, startStage, &m_nodes[i])) {
+                ERROR("create thread for stage %s failed", m_nodes[i].stage->name());
+                cancel();
+                break;
+            }
+            threads.push_back(thread);
+        }
+        for (size_t i = 0; i < threads.size(); i++)
+            pthread_join(threads[i], NULL);
+        StageThreadLimit::instance().release(m_nodes.size());
+        report(now() - start);
+        return !cancelled();
+    }
+
+    void cancel()
+    {
+        {
+            AutoLock lock(m_lock);
+            if (m_cancelled)
+                return;
+            m_cancelled = true;
+        }
+        for (size_t i = 0; i < m_queues.size(); i++)
+            m_queues[i]->cancel();
+    }
+
+    bool cancelled()
+    {
+        AutoLock lock(m_lock);
+        return m_cancelled;
+    }
+
+private:
+    struct Node {
+        SharedPtr<Stage> stage;
+        std::vector<SharedPtr<QueueBase> > outputs;
+        Pipeline* pipeline;
+    };
+
+    static uint64_t now(clockid_t clock = CLOCK_MONOTONIC)
+    {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    static void* startStage(void* node)
+    {
+        ((Node*)node)->pipeline->runStage(*(Node*)node);
+        return NULL;
+    }
+
+    void runStage(Node& node)
+    {
+        uint64_t start = now();
+        uint64_t cpu = now(CLOCK_THREAD_CPUTIME_ID);
+        bool ret = node.stage->run();
+        node.stage->m_elapsed = now() - start;
+        node.stage->m_cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        if (!ret) {
+            ERROR("stage %s failed", node.stage->name());
+            cancel();
+        }
+        for (size_t i = 0; i < node.outputs.size(); i++)
+            node.outputs[i]->close();
+    }
+
+    //items per second of each stage, how much of its time it was not waiting on a queue and
+    //how much it was on a cpu, then what overloaded queues dropped. busy but not on a cpu is
+    //time in the driver or preempted, what stages of other pipelines contend for.
+    //printed at once, other pipelines of the process may report at the same time
+    void report(uint64_t elapsed)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "%s: %.3f seconds", m_name.c_str(), elapsed / 1e9);
+        std::string report(line);
+        if (m_queued > 1000000) {
+            snprintf(line, sizeof(line), ", %.3f seconds waiting for stage threads", m_queued / 1e9);
+            report += line;
+        }
+        report += "\n";
+        for (size_t i = 0; i < m_nodes.size(); i++) {
+            const Stage& stage = *m_nodes[i].stage;
+            double seconds = stage.m_elapsed / 1e9;
+            double busy = stage.m_elapsed ? 100.0 * (stage.m_elapsed - stage.m_waited) / stage.m_elapsed : 0;
+            double cpu = stage.m_elapsed ? 100.0 * stage.m_cpu / stage.m_elapsed : 0;
+            snprintf(line, sizeof(line), "    %-9s %8llu items %10.2f /s  busy %5.1f%%  cpu %5.1f%%\n", stage.name(),
+                (unsigned long long)stage.items(), seconds > 0 ? stage.items() / seconds : 0, busy, cpu);
+            report += line;
+        }
+        for (size_t i = 0; i < m_queues.size(); i++) {
+            std::string stats = m_queues[i]->stats();
+            if (!stats.empty()) {
+                snprintf(line, sizeof(line), "    queue %-3d %s\n", (int)i, stats.c_str());
+                report += line;
+            }
+        }
+        fputs(report.c_str(), stdout);
+    }
+
+    std::string m_name;
+    Lock m_lock;
+    bool m_cancelled;
+    //nanoseconds run() waited for StageThreadLimit
+    uint64_t m_queued;
+    //a vector of Node, threads get pointers to them, so no add() after run()
+    std::vector<Node> m_nodes;
+    std::vector<SharedPtr<QueueBase> > m_queues;
+    DISALLOW_COPY_AND_ASSIGN(Pipeline);
+};
+};
+
+#endif //Pipeline_h
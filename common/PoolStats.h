@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PoolStats_h
+#define PoolStats_h
+
+#include "common/NonCopyable.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/PooledFrameAllocator.h"
+#include <VideoCommonDefs.h>
+
+#include <algorithm>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+inline uint64_t getMonotonicTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//power of 2 buckets in microseconds, bucket i counts values in [2^(i-1), 2^i)
+class TimeHistogram {
+public:
+    TimeHistogram()
+        : m_count(0)
+        , m_sum(0)
+        , m_max(0)
+    {
+        memset(m_buckets, 0, sizeof(m_buckets));
+    }
+
+    void add(uint64_t us)
+    {
+        uint32_t i = 0;
+        while (i < BUCKETS - 1 && (1ULL << i) <= us)
+            i++;
+        m_buckets[i]++;
+        m_count++;
+        m_sum += us;
+        if (us > m_max)
+            m_max = us;
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t max() const { return m_max; }
+
+    //upper bound of the bucket holding the p-th percentile
+    uint64_t percentile(uint32_t p) const
+    {
+        uint64_t target = (m_count * p + 99) / 100;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            seen += m_buckets[i];
+            if (seen && seen >= target)
+                return std::min(1ULL << i, (unsigned long long)m_max);
+        }
+        return m_max;
+    }
+
+    void dumpJson(FILE* fp) const
+    {
+        fprintf(fp, "{\"count\": %llu, \"sum_us\": %llu, \"max_us\": %llu, "
+                    "\"p50_us\": %llu, \"p90_us\": %llu, \"p99_us\": %llu, \"buckets\": [",
+            (unsigned long long)m_count, (unsigned long long)m_sum,
+            (unsigned long long)m_max, (unsigned long long)percentile(50),
+            (unsigned long long)percentile(90), (unsigned long long)percentile(99));
+        bool first = true;
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            if (!m_buckets[i])
+                continue;
+            fprintf(fp, "%s{\"lt_us\": %llu, \"count\": %llu}", first ? "" : ", ",
+                1ULL << i, (unsigned long long)m_buckets[i]);
+            first = false;
+        }
+        fprintf(fp, "]}");
+    }
+
+private:
+    static const uint32_t BUCKETS = 40;
+    uint64_t m_buckets[BUCKETS];
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_max;
+};
+
+//usage of one frame pool, normally one pipeline stage
+class PoolStats {
+public:
+    PoolStats(const char* name, int poolsize)
+        : m_name(name)
+        , m_poolsize(poolsize)
+        , m_allocs(0)
+        , m_failures(0)
+        , m_inFlight(0)
+        , m_maxInFlight(0)
+    {
+    }
+
+    void onAlloc(uint64_t allocUs, bool success)
+    {
+        AutoLock _l(m_lock);
+        m_allocTime.add(allocUs);
+        if (!success) {
+            m_failures++;
+            return;
+        }
+        m_allocs++;
+        m_inFlight++;
+        if (m_inFlight > m_maxInFlight)
+            m_maxInFlight = m_inFlight;
+    }
+
+    void onRelease(uint64_t holdUs)
+    {
+        AutoLock _l(m_lock);
+        m_inFlight--;
+        m_holdTime.add(holdUs);
+    }
+
+    void dumpJson(FILE* fp)
+    {
+        AutoLock _l(m_lock);
+        fprintf(fp, "{\"name\": \"%s\", \"pool_size\": %d, \"allocs\": %llu, "
+                    "\"alloc_failures\": %llu, \"in_flight\": %d, \"max_in_flight\": %d, ",
+            m_name.c_str(), m_poolsize, (unsigned long long)m_allocs,
+            (unsigned long long)m_failures, m_inFlight, m_maxInFlight);
+        fprintf(fp, "\"hold_time\": ");
+        m_holdTime.dumpJson(fp);
+        fprintf(fp, ", \"alloc_time\": ");
+        m_allocTime.dumpJson(fp);
+        fprintf(fp, "}");
+    }
+
+private:
+    Lock m_lock;
+    std::string m_name;
+    int m_poolsize;
+    uint64_t m_allocs;
+    uint64_t m_failures;
+    int m_inFlight;
+    int m_maxInFlight;
+    TimeHistogram m_holdTime;
+    TimeHistogram m_allocTime;
+    DISALLOW_COPY_AND_ASSIGN(PoolStats);
+};
+
+//All PoolStats of the process. Once an output is set, they are dumped as
+//json at exit and each time the process gets SIGUSR1.
+class PoolStatsRegistry {
+public:
+    static PoolStatsRegistry& instance()
+    {
+        static PoolStatsRegistry registry;
+        return registry;
+    }
+
+    //path "-" means stderr
+    bool setOutput(const char* path)
+    {
+        AutoLock _l(m_lock);
+        if (!m_path.empty())
+            return true;
+        if (pipe(m_pipe)) {
+            ERROR("create pipe for SIGUSR1 failed");
+            return false;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, dumpLoop, this)) {
+            ERROR("create pool stats thread failed");
+            return false;
+        }
+        pthread_detach(thread);
+        m_path = path;
+        signal(SIGUSR1, onSignal);
+        atexit(onExit);
+        return true;
+    }
+
+    bool enabled()
+    {
+        AutoLock _l(m_lock);
+        return !m_path.empty();
+    }
+
+    void add(const SharedPtr<PoolStats>& stats)
+    {
+        AutoLock _l(m_lock);
+        m_stats.push_back(stats);
+    }
+
+    void dump()
+    {
+        AutoLock _l(m_lock);
+        if (m_path.empty())
+            return;
+        bool toStderr = (m_path == "-");
+        FILE* fp = toStderr ? stderr : fopen(m_path.c_str(), "w");
+        if (!fp) {
+            ERROR("can't open %s for pool stats", m_path.c_str());
+            return;
+        }
+        fprintf(fp, "{\"pools\": [");
+        for (size_t i = 0; i < m_stats.size(); i++) {
+            fprintf(fp, "%s\n  ", i ? "," : "");
+            m_stats[i]->dumpJson(fp);
+        }
+        fprintf(fp, "\n]}\n");
+        if (toStderr)
+            fflush(fp);
+        else
+            fclose(fp);
+    }
+
+private:
+    PoolStatsRegistry()
+    {
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+
+    //only async-signal-safe calls here, the dump itself runs in dumpLoop
+    static void onSignal(int)
+    {
+        char c = 0;
+        ssize_t n = write(instance().m_pipe[1], &c, 1);
+        (void)n;
+    }
+
+    static void onExit()
+    {
+        instance().dump();
+    }
+
+    static void* dumpLoop(void* arg)
+    {
+        PoolStatsRegistry* registry = (PoolStatsRegistry*)arg;
+        char c;
+        while (read(registry->m_pipe[0], &c, 1) == 1)
+            registry->dump();
+        return NULL;
+    }
+
+    Lock m_lock;
+    std::string m_path;
+    int m_pipe[2];
+    std::vector<SharedPtr<PoolStats> > m_stats;
+    DISALLOW_COPY_AND_ASSIGN(PoolStatsRegistry);
+};
+
+//Wraps another FrameAllocator and feeds a PoolStats.
+//The wrapping SharedPtr takes its control block from a ControlBlockCache,
+//so this does not add heap allocations per frame.
+class InstrumentedFrameAllocator : public FrameAllocator {
+public:
+    InstrumentedFrameAllocator(const char* name, const SharedPtr<FrameAllocator>& allocator, int poolsize)
+        : m_allocator(allocator)
+        , m_stats(new PoolStats(name, poolsize))
+        , m_cache(new ControlBlockCache(poolsize))
+    {
+        PoolStatsRegistry::instance().add(m_stats);
+    }
+
+    bool setFormat(uint32_t fourcc, int width, int height)
+    {
+        return m_allocator->setFormat(fourcc, width, height);
+    }
+
+    SharedPtr<VideoFrame> alloc()
+    {
+        uint64_t start = getMonotonicTimeUs();
+        SharedPtr<VideoFrame> frame = m_allocator->alloc();
+        uint64_t now = getMonotonicTimeUs();
+        m_stats->onAlloc(now - start, bool(frame));
+        SharedPtr<VideoFrame> ret;
+        if (!frame)
+            return ret;
+        VideoFrame* p = frame.get();
+#if __cplusplus > 199711L
+        ret.reset(p, Releaser(frame, m_stats, now), ControlBlockAllocator<VideoFrame>(m_cache));
+#else
+        ret.reset(p, Releaser(frame, m_stats, now));
+#endif
+        return ret;
+    }
+
+private:
+    //keeps the inner frame alive until the wrapper is released
+    class Releaser {
+    public:
+        Releaser(const SharedPtr<VideoFrame>& frame, const SharedPtr<PoolStats>& stats, uint64_t start)
+            : m_frame(frame)
+            , m_stats(stats)
+            , m_start(start)
+        {
+        }
+        void operator()(VideoFrame*) const
+        {
+            m_stats->onRelease(getMonotonicTimeUs() - m_start);
+        }
+
+    private:
+        SharedPtr<VideoFrame> m_frame;
+        SharedPtr<PoolStats> m_stats;
+        uint64_t m_start;
+    };
+
+    SharedPtr<FrameAllocator> m_allocator;
+    SharedPtr<PoolStats> m_stats;
+    SharedPtr<ControlBlockCache> m_cache;
+};
+
+//wrap allocator with InstrumentedFrameAllocator if pool stats are enabled
+inline SharedPtr<FrameAllocator> instrumentAllocator(const char* name,
+    const SharedPtr<FrameAllocator>& allocator, int poolsize)
+{
+    if (!allocator || !PoolStatsRegistry::instance().enabled())
+        return allocator;
+    SharedPtr<FrameAllocator> instrumented(new InstrumentedFrameAllocator(name, allocator, poolsize));
+    return instrumented;
+}
+};
+
+#endif //PoolStats_h
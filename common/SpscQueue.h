@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SpscQueue_h
+#define SpscQueue_h
+
+#include "common/NonCopyable.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+//Bounded ring for exactly one pushing thread and one popping thread.
+//The fast path is a few atomic loads and stores, no lock. A side that has to wait
+//spins a little, then parks on a futex; the other side only makes the wake syscall
+//when it sees the waiting flag, so a queue that never runs full or empty never
+//enters the kernel.
+template <class T>
+class SpscQueue {
+public:
+    explicit SpscQueue(uint32_t capacity)
+        : m_items(slots(capacity))
+        , m_capacity(capacity ? capacity : 1)
+        , m_mask(slots(capacity) - 1)
+        , m_head(0)
+        , m_tail(0)
+        , m_closed(0)
+        , m_cancelled(0)
+        , m_popSeq(0)
+        , m_popWaiting(0)
+        , m_popWant(0)
+        , m_pushSeq(0)
+        , m_pushWaiting(0)
+        , m_pushWant(0)
+    {
+    }
+
+    //producer side, blocks while full, false if cancelled
+    bool push(const T& item)
+    {
+        uint32_t tail = relaxed(m_tail);
+        while (tail - acquire(m_head) >= m_capacity) {
+            //once full, let the consumer free half of the ring before we are woken,
+            //so we do not bounce on every pop
+            uint32_t half = m_capacity / 2 ? m_capacity / 2 : 1;
+            if (!waitFor(m_pushSeq, m_pushWaiting, m_pushWant, tail - m_capacity + half, m_head))
+                return false;
+        }
+        m_items[tail & m_mask] = item;
+        release(m_tail, tail + 1);
+        wake(m_popSeq, m_popWaiting, m_popWant, tail + 1);
+        return true;
+    }
+
+    //consumer side, blocks while empty, false on eos or if cancelled
+    bool pop(T& item)
+    {
+        return pop(&item, 1) == 1;
+    }
+
+    //consumer side, takes up to max items with one hand-off,
+    //blocks only while empty, 0 on eos or if cancelled
+    uint32_t pop(T* items, uint32_t max)
+    {
+        uint32_t head = relaxed(m_head);
+        uint32_t tail;
+        while ((tail = acquire(m_tail)) == head) {
+            //closed is set after the last push, so check tail once more
+            if (acquire(m_closed) && acquire(m_tail) == head)
+                return 0;
+            if (!waitFor(m_popSeq, m_popWaiting, m_popWant, head + 1, m_tail))
+                return 0;
+        }
+        if (acquire(m_cancelled))
+            return 0;
+        uint32_t n = tail - head < max ? tail - head : max;
+        for (uint32_t i = 0; i < n; i++) {
+            T& slot = m_items[(head + i) & m_mask];
+            items[i] = slot;
+            //do not hold a reference in the ring, frames go back to their pool
+            slot = T();
+        }
+        release(m_head, head + n);
+        wake(m_pushSeq, m_pushWaiting, m_pushWant, head + n);
+        return n;
+    }
+
+    //producer side, no more items
+    void close()
+    {
+        release(m_closed, 1u);
+        wakeAlways(m_popSeq);
+    }
+
+    //any thread, wake up both sides and fail all calls from now on.
+    //items left in the ring are released when the queue is destroyed
+    void cancel()
+    {
+        release(m_cancelled, 1u);
+        wakeAlways(m_popSeq);
+        wakeAlways(m_pushSeq);
+    }
+
+    bool cancelled() const { return acquire(m_cancelled); }
+    uint32_t capacity() const { return m_capacity; }
+
+private:
+    //indices wrap at 2^32, a slot count that divides it keeps index & mask in order
+    //across the wrap. the ring still holds at most capacity items
+    static uint32_t slots(uint32_t capacity)
+    {
+        uint32_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        return n;
+    }
+
+    static uint32_t relaxed(const uint32_t& v) { return __atomic_load_n(&v, __ATOMIC_RELAXED); }
+    static uint32_t acquire(const uint32_t& v) { return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+    static void release(uint32_t& v, uint32_t value) { __atomic_store_n(&v, value, __ATOMIC_RELEASE); }
+
+    static void cpuRelax()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    //spinning only helps if the other side runs at the same time
+    static uint32_t spinCount()
+    {
+        static const uint32_t count = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+        return count;
+    }
+
+    //index is past target, indices wrap
+    static bool reached(uint32_t index, uint32_t target) { return (int32_t)(index - target) >= 0; }
+
+    //wait until the other side moves index to target, false if cancelled
+    bool waitFor(uint32_t& seq, uint32_t& waiting, uint32_t& want, uint32_t target, const uint32_t& index)
+    {
+        for (uint32_t i = 0; i < spinCount(); i++) {
+            if (acquire(m_cancelled))
+                return false;
+            if (reached(acquire(index), target))
+                return true;
+            cpuRelax();
+        }
+        uint32_t current = acquire(seq);
+        __atomic_store_n(&want, target, __ATOMIC_RELAXED);
+        __atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+        //pairs with the fence in wake(), either we see the move or it sees the flag
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (acquire(m_cancelled))
+            return false;
+        if (reached(acquire(index), target) || acquire(m_closed))
+            return true;
+        //returns at once if seq moved since we read it
+        syscall(SYS_futex, &seq, FUTEX_WAIT_PRIVATE, current, NULL, NULL, 0);
+        return !acquire(m_cancelled);
+    }
+
+    //index was just moved, wake the other side if it waits for it
+    static void wake(uint32_t& seq, uint32_t& waiting, const uint32_t& want, uint32_t index)
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!acquire(waiting) || !reached(index, relaxed(want)))
+            return;
+        if (__atomic_exchange_n(&waiting, 0, __ATOMIC_ACQ_REL))
+            wakeAlways(seq);
+    }
+
+    static void wakeAlways(uint32_t& seq)
+    {
+        __atomic_add_fetch(&seq, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+
+    //a hand-off usually lands within a few hundred cycles, parking costs far more
+    static const uint32_t SPIN_COUNT = 128;
+    //keep the two sides' indices in different cache lines
+    static const uint32_t CACHE_LINE = 64;
+
+    std::vector<T> m_items;
+    uint32_t m_capacity;
+    uint32_t m_mask;
+    char m_pad0[CACHE_LINE];
+    //written by the consumer only
+    uint32_t m_head;
+    char m_pad1[CACHE_LINE];
+    //written by the producer only
+    uint32_t m_tail;
+    char m_pad2[CACHE_LINE];
+    uint32_t m_closed;
+    uint32_t m_cancelled;
+    //futex words, bumped on every wake up
+    uint32_t m_popSeq;
+    uint32_t m_popWaiting;
+    uint32_t m_popWant;
+    uint32_t m_pushSeq;
+    uint32_t m_pushWaiting;
+    uint32_t m_pushWant;
+    DISALLOW_COPY_AND_ASSIGN(SpscQueue);
+};
+};
+
+#endif //SpscQueue_h
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SystemMemoryFrameAllocator_h
+#define SystemMemoryFrameAllocator_h
+
+#include "common/NonCopyable.h"
+#include "common/common_def.h"
+#include "common/log.h"
+#include "common/utils.h"
+#include "common/PooledFrameAllocator.h"
+#include <VideoCommonDefs.h>
+
+#include <deque>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+namespace YamiMediaCodec {
+
+//a VideoFrame backed by host memory.
+//surface points to the frame itself, so we can tell it from a va surface.
+struct SystemMemoryFrame : public VideoFrame {
+    uint8_t* data;
+    uint32_t size;
+    uint32_t planes;
+    uint32_t pitch[3];
+    uint32_t offset[3];
+};
+
+//return NULL if frame is not allocated by SystemMemoryFrameAllocator
+inline SystemMemoryFrame* getSystemMemoryFrame(const SharedPtr<VideoFrame>& frame)
+{
+    if (!frame || frame->surface != (intptr_t)frame.get())
+        return NULL;
+    return static_cast<SystemMemoryFrame*>(frame.get());
+}
+
+//hands out SystemMemoryFrame, no va display needed.
+//all frames share one 64 bytes aligned arena, it can be backed by huge pages.
+class SystemMemoryFrameAllocator : public FrameAllocator {
+public:
+    SystemMemoryFrameAllocator(int poolsize, bool hugePage = false)
+        : m_poolsize(poolsize)
+        , m_hugePage(hugePage)
+    {
+    }
+
+    bool setFormat(uint32_t fourcc, int width, int height)
+    {
+        uint32_t byteWidth[3], byteHeight[3], planes;
+        if (m_poolsize <= 0
+            || !getPlaneResolution(fourcc, width, height, byteWidth, byteHeight, planes)) {
+            ERROR("unsupported format %.4s, %dx%d", (char*)&fourcc, width, height);
+            return false;
+        }
+        uint32_t frameSize = 0;
+        uint32_t pitch[3], offset[3];
+        for (uint32_t i = 0; i < planes; i++) {
+            pitch[i] = ALIGN_POW2(byteWidth[i], ALIGNMENT);
+            offset[i] = frameSize;
+            frameSize += pitch[i] * byteHeight[i];
+        }
+        SharedPtr<Arena> arena(new Arena);
+        if (!arena->alloc((size_t)frameSize * m_poolsize, m_hugePage)) {
+            ERROR("failed to allocate %d frames of %d bytes", m_poolsize, frameSize);
+            return false;
+        }
+        std::deque<SharedPtr<VideoFrame> > buffers;
+        for (int i = 0; i < m_poolsize; i++) {
+            SystemMemoryFrame* f = new SystemMemoryFrame;
+            memset(f, 0, sizeof(SystemMemoryFrame));
+            f->surface = (intptr_t)f;
+            f->fourcc = fourcc;
+            f->crop.width = width;
+            f->crop.height = height;
+            f->data = arena->data + (size_t)frameSize * i;
+            f->size = frameSize;
+            f->planes = planes;
+            memcpy(f->pitch, pitch, sizeof(pitch));
+            memcpy(f->offset, offset, sizeof(offset));
+            buffers.push_back(SharedPtr<VideoFrame>(f, FrameDeleter(arena)));
+        }
+        m_pool.reset(new VideoPool<VideoFrame>(buffers));
+        return true;
+    }
+
+    SharedPtr<VideoFrame> alloc()
+    {
+        SharedPtr<VideoFrame> frame;
+        if (m_pool)
+            frame = m_pool->alloc();
+        return frame;
+    }
+
+private:
+    static const uint32_t ALIGNMENT = 64;
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    struct Arena {
+        Arena()
+            : data(NULL)
+            , size(0)
+            , mapped(false)
+        {
+        }
+        bool alloc(size_t bytes, bool hugePage)
+        {
+            if (hugePage) {
+                size = ALIGN_POW2(bytes, HUGE_PAGE_SIZE);
+                void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (p != MAP_FAILED) {
+                    data = (uint8_t*)p;
+                    mapped = true;
+                    return true;
+                }
+                //no reserved huge pages, ask for transparent huge pages.
+                if (posix_memalign((void**)&data, HUGE_PAGE_SIZE, size))
+                    return false;
+                madvise(data, size, MADV_HUGEPAGE);
+                return true;
+            }
+            size = bytes;
+            return !posix_memalign((void**)&data, ALIGNMENT, size);
+        }
+        ~Arena()
+        {
+            if (mapped)
+                munmap(data, size);
+            else
+                free(data);
+        }
+        uint8_t* data;
+        size_t size;
+        bool mapped;
+    private:
+        DISALLOW_COPY_AND_ASSIGN(Arena);
+    };
+
+    class FrameDeleter {
+    public:
+        FrameDeleter(const SharedPtr<Arena>& arena)
+            : m_arena(arena)
+        {
+        }
+        void operator()(VideoFrame* frame) const
+        {
+            delete static_cast<SystemMemoryFrame*>(frame);
+        }
+
+    private:
+        SharedPtr<Arena> m_arena;
+    };
+
+    int m_poolsize;
+    bool m_hugePage;
+    SharedPtr<VideoPool<VideoFrame> > m_pool;
+};
+};
+
+#endif //SystemMemoryFrameAllocator_h
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include "common/CpuAffinity.h"
+#include "common/NonCopyable.h"
+#include "common/condition.h"
+#include "common/lock.h"
+#include <VideoCommonDefs.h>
+
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+class ThreadPool;
+
+//work for a ThreadPool, any thread may wait for it
+class Task {
+public:
+    Task()
+        : m_cond(m_lock)
+        , m_pool(NULL)
+        , m_done(false)
+    {
+    }
+    virtual ~Task() {}
+
+    //till run() returned. runs other tasks of the pool meanwhile, so a task
+    //waiting for the tasks it submitted does not hold up a worker
+    void wait();
+
+    //false if run() did not return within milliseconds
+    bool wait(uint32_t milliseconds)
+    {
+        AutoLock lock(m_lock);
+        if (!m_done)
+            m_cond.timedWait(milliseconds);
+        return m_done;
+    }
+
+    bool done()
+    {
+        AutoLock lock(m_lock);
+        return m_done;
+    }
+
+protected:
+    virtual void run() = 0;
+
+private:
+    friend class ThreadPool;
+    void execute()
+    {
+        run();
+        AutoLock lock(m_lock);
+        m_done = true;
+        m_cond.broadcast();
+    }
+
+    Lock m_lock;
+    Condition m_cond;
+    ThreadPool* m_pool;
+    bool m_done;
+    DISALLOW_COPY_AND_ASSIGN(Task);
+};
+
+//a task computing a value, get() waits for it
+template <class T>
+class Future : public Task {
+public:
+    const T& get()
+    {
+        wait();
+        return m_result;
+    }
+
+protected:
+    virtual T compute() = 0;
+
+private:
+    void run() { m_result = compute(); }
+    T m_result;
+};
+
+//Worker threads with a task deque each. A worker takes the newest task of its own
+//deque, still warm in its cache, and steals the oldest of another deque when its
+//own is empty. Tasks submitted from a worker go to its own deque, the others are
+//spread over all of them. The deques have their own locks, so workers only meet
+//when they steal.
+//Errors go to stderr, psnr uses this without libyami.
+class ThreadPool {
+public:
+    //threads: 0 for one per online cpu. affinity: where the workers run, NULL to
+    //run where the creating thread may
+    explicit ThreadPool(uint32_t threads = 0, const CpuAffinity* affinity = NULL)
+        : m_started(0)
+        , m_cond(m_lock)
+        , m_queued(0)
+        , m_next(0)
+        , m_pinned(affinity != NULL)
+        , m_quit(false)
+    {
+        if (affinity)
+            m_affinity = *affinity;
+        if (!threads)
+            threads = defaultThreads();
+        for (uint32_t i = 0; i < threads; i++) {
+            Worker* worker = new Worker;
+            worker->pool = this;
+            worker->index = i;
+            m_workers.push_back(worker);
+        }
+        //workers that did not start keep an empty deque
+        for (; m_started < m_workers.size(); m_started++) {
+            if (pthread_create(&m_workers[m_started]->thread, NULL, start, m_workers[m_started])) {
+                fprintf(stderr, "create thread failed, use %d threads\n", m_started);
+                break;
+            }
+        }
+    }
+
+    //runs the queued tasks, then stops the workers
+    ~ThreadPool()
+    {
+        {
+            AutoLock lock(m_lock);
+            m_quit = true;
+            m_cond.broadcast();
+        }
+        for (uint32_t i = 0; i < m_started; i++)
+            pthread_join(m_workers[i]->thread, NULL);
+        for (size_t i = 0; i < m_workers.size(); i++)
+            delete m_workers[i];
+    }
+
+    static uint32_t defaultThreads()
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        return cpus > 1 ? (uint32_t)cpus : 1;
+    }
+
+    uint32_t threads() const { return m_started; }
+
+    void submit(const SharedPtr<Task>& task)
+    {
+        task->m_pool = this;
+        if (!m_started) {
+            task->execute();
+            return;
+        }
+        Worker* worker = current();
+        if (!worker || worker->pool != this)
+            worker = m_workers[__atomic_fetch_add(&m_next, 1, __ATOMIC_RELAXED) % m_started];
+        {
+            //counted under the lock that publishes the task, so take() can't
+            //count it out before it is counted in and wrap m_queued
+            AutoLock lock(worker->lock);
+            worker->tasks.push_back(task);
+            __atomic_add_fetch(&m_queued, 1, __ATOMIC_RELAXED);
+        }
+        AutoLock lock(m_lock);
+        m_cond.signal();
+    }
+
+    //calls body(first, last) for ranges covering [begin, end), at least grain
+    //wide, on the workers and the calling thread. returns when all are done
+    template <class Body>
+    void parallelFor(uint32_t begin, uint32_t end, uint32_t grain, Body& body)
+    {
+        if (begin >= end)
+            return;
+        //a few ranges for each thread, so one slow range does not hold up the others
+        uint32_t parts = (threads() + 1) * 4;
+        uint32_t step = (end - begin + parts - 1) / parts;
+        if (step < grain)
+            step = grain;
+        if (!step)
+            step = 1;
+        SharedPtr<Range<Body> > range(new Range<Body>(begin, end, step, body));
+        uint32_t helpers = range->count - 1;
+        if (helpers > threads())
+            helpers = threads();
+        for (uint32_t i = 0; i < helpers; i++)
+            submit(SharedPtr<Task>(new RangeTask<Body>(range)));
+        range->work();
+        range->wait();
+    }
+
+    //runs one queued task on the calling thread, false if there is none
+    bool runOne()
+    {
+        SharedPtr<Task> task = take(current());
+        if (!task)
+            return false;
+        task->execute();
+        return true;
+    }
+
+private:
+    struct Worker {
+        ThreadPool* pool;
+        uint32_t index;
+        pthread_t thread;
+        Lock lock;
+        std::deque<SharedPtr<Task> > tasks;
+    };
+
+    //parallelFor() state, shared with its tasks. a task that starts after the
+    //caller returned finds no range left and does not touch body
+    template <class Body>
+    struct Range {
+        Range(uint32_t begin, uint32_t end, uint32_t step, Body& body)
+            : begin(begin)
+            , end(end)
+            , step(step)
+            , count((end - begin + step - 1) / step)
+            , next(0)
+            , finished(0)
+            , cond(lock)
+            , body(body)
+        {
+        }
+
+        //take ranges until all are taken
+        void work()
+        {
+            uint32_t i;
+            while ((i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < count) {
+                uint32_t first = begin + i * step;
+                body(first, end - first > step ? first + step : end);
+                AutoLock l(lock);
+                if (++finished == count)
+                    cond.broadcast();
+            }
+        }
+
+        void wait()
+        {
+            AutoLock l(lock);
+            while (finished != count)
+                cond.wait();
+        }
+
+        uint32_t begin;
+        uint32_t end;
+        uint32_t step;
+        uint32_t count;
+        uint32_t next;
+        uint32_t finished;
+        Lock lock;
+        Condition cond;
+        Body& body;
+    };
+
+    template <class Body>
+    class RangeTask : public Task {
+    public:
+        explicit RangeTask(const SharedPtr<Range<Body> >& range)
+            : m_range(range)
+        {
+        }
+
+    private:
+        void run() { m_range->work(); }
+        SharedPtr<Range<Body> > m_range;
+    };
+
+    //the worker running on this thread, NULL for other threads
+    static Worker*& current()
+    {
+        static __thread Worker* worker = NULL;
+        return worker;
+    }
+
+    static void* start(void* arg)
+    {
+        Worker* worker = (Worker*)arg;
+        current() = worker;
+        worker->pool->loop(worker);
+        return NULL;
+    }
+
+    void loop(Worker* self)
+    {
+        if (m_pinned)
+            m_affinity.apply();
+        while (1) {
+            SharedPtr<Task> task = take(self);
+            if (task) {
+                task->execute();
+                continue;
+            }
+            AutoLock lock(m_lock);
+            while (!__atomic_load_n(&m_queued, __ATOMIC_RELAXED) && !m_quit)
+                m_cond.wait();
+            if (m_quit && !__atomic_load_n(&m_queued, __ATOMIC_RELAXED))
+                return;
+        }
+    }
+
+    //the newest task of self, or the oldest of another worker
+    SharedPtr<Task> take(Worker* self)
+    {
+        SharedPtr<Task> task;
+        if (self && self->pool != this)
+            self = NULL;
+        if (self) {
+            AutoLock lock(self->lock);
+            if (!self->tasks.empty()) {
+                task = self->tasks.back();
+                self->tasks.pop_back();
+            }
+        }
+        size_t first = self ? self->index + 1 : 0;
+        for (size_t i = 0; !task && i < m_workers.size(); i++) {
+            Worker* victim = m_workers[(first + i) % m_workers.size()];
+            if (victim == self)
+                continue;
+            AutoLock lock(victim->lock);
+            if (!victim->tasks.empty()) {
+                task = victim->tasks.front();
+                victim->tasks.pop_front();
+            }
+        }
+        if (task)
+            __atomic_sub_fetch(&m_queued, 1, __ATOMIC_RELAXED);
+        return task;
+    }
+
+    std::vector<Worker*> m_workers;
+    uint32_t m_started;
+    //sleeping workers wait for m_queued to move
+    Lock m_lock;
+    Condition m_cond;
+    uint32_t m_queued;
+    uint32_t m_next;
+    CpuAffinity m_affinity;
+    bool m_pinned;
+    bool m_quit;
+    DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+
+inline void Task::wait()
+{
+    while (!done()) {
+        if (m_pool && m_pool->runOne())
+            continue;
+        //nothing queued, so the task runs on another thread
+        AutoLock lock(m_lock);
+        while (!m_done)
+            m_cond.wait();
+        return;
+    }
+}
+};
+
+#endif //ThreadPool_h
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VaapiMappedImage_h
+#define VaapiMappedImage_h
+
+#include "common/MappedFrameAllocator.h"
+#include "common/NonCopyable.h"
+#include "common/VaapiUtils.h"
+#include <VideoCommonDefs.h>
+
+#include <va/va.h>
+
+namespace YamiMediaCodec {
+
+//The derived VAImage of one frame, mapped until unmap() or destruction.
+//The frame is held while mapped, so its surface can't go back to the pool,
+//be rewritten by the decoder or be destroyed under the mapping.
+//Frames of a MappedFrameAllocator lend the mapping their pool entry keeps,
+//others, like decoder surfaces, are derived and mapped each time.
+//The display must outlive the mapping.
+class VaapiMappedImage {
+public:
+    VaapiMappedImage(VADisplay display)
+        : m_display(display)
+        , m_data(NULL)
+        , m_owned(false)
+    {
+    }
+
+    ~VaapiMappedImage()
+    {
+        unmap();
+    }
+
+    //return NULL on failure
+    uint8_t* map(const SharedPtr<VideoFrame>& frame)
+    {
+        unmap();
+        m_data = MappedFrameAllocator::map(frame, m_image);
+        m_owned = !m_data;
+        if (m_owned)
+            m_data = mapSurfaceToImage(m_display, frame->surface, m_image);
+        if (m_data)
+            m_frame = frame;
+        return m_data;
+    }
+
+    void unmap()
+    {
+        if (!m_data)
+            return;
+        if (m_owned)
+            unmapImage(m_display, m_image);
+        m_data = NULL;
+        m_frame.reset();
+    }
+
+    const VAImage& image() const { return m_image; }
+
+private:
+    VADisplay m_display;
+    VAImage m_image;
+    uint8_t* m_data;
+    //mapped by us, not lent by a pool entry
+    bool m_owned;
+    SharedPtr<VideoFrame> m_frame;
+    DISALLOW_COPY_AND_ASSIGN(VaapiMappedImage);
+};
+};
+
+#endif //VaapiMappedImage_h
@@ -0,0 +1,474 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WriteBehindFile_h
+#define WriteBehindFile_h
+
+#include "common/NonCopyable.h"
+#include "common/common_def.h"
+#include "common/condition.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/PoolStats.h"
+
+#include <algorithm>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+//Output file with a dedicated writer thread.
+//Data written through the FILE* is copied into fixed size chunks, full
+//chunks are queued and written by the thread, so a slow disk only blocks
+//the caller when all chunks are queued.
+//Chunks are page aligned, with direct io they skip the page cache.
+//The file is preallocated in large steps and trimmed to its real size on close.
+class WriteBehindFile {
+public:
+    //queueDepth 0 means plain stdio files, set it before opening any output
+    static void setQueueDepth(uint32_t queueDepth)
+    {
+        settings().queueDepth = queueDepth;
+    }
+
+    //only used with write-behind
+    static void setDirectIO(bool directIO)
+    {
+        settings().directIO = directIO;
+    }
+
+    //write-behind or direct io was asked for
+    static bool requested()
+    {
+        return settings().queueDepth || settings().directIO;
+    }
+
+    //same as fopen for the write modes, but returns a write-behind FILE* if enabled
+    static FILE* open(const char* path, const char* mode)
+    {
+        if (!settings().queueDepth)
+            return fopen(path, mode);
+        WriteBehindFile* file = new WriteBehindFile(path, settings().queueDepth);
+        if (!file->init(settings().directIO)) {
+            file->close();
+            delete file;
+            return NULL;
+        }
+        cookie_io_functions_t funcs = { NULL, cookieWrite, cookieSeek, cookieClose };
+        FILE* fp = fopencookie(file, mode, funcs);
+        if (!fp) {
+            file->close();
+            delete file;
+            return NULL;
+        }
+        //we copy into chunks anyway, no need for the stdio buffer
+        setvbuf(fp, NULL, _IONBF, 0);
+        file->m_fp = fp;
+        AutoLock _l(registryLock());
+        registry()[fp] = file;
+        return fp;
+    }
+
+    //wait until everything written so far is on the file, works for plain FILE* too
+    static bool flush(FILE* fp)
+    {
+        if (!fp)
+            return false;
+        if (fflush(fp))
+            return false;
+        WriteBehindFile* file = NULL;
+        {
+            AutoLock _l(registryLock());
+            Registry::iterator it = registry().find(fp);
+            if (it != registry().end())
+                file = it->second;
+        }
+        return !file || file->flush();
+    }
+
+private:
+    static const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+    static const size_t DIRECT_ALIGNMENT = 4096;
+    static const off_t PREALLOCATE_STEP = 64 * 1024 * 1024;
+
+    struct Settings {
+        Settings()
+            : queueDepth(0)
+            , directIO(false)
+        {
+        }
+        uint32_t queueDepth;
+        bool directIO;
+    };
+
+    struct Chunk {
+        uint8_t* data;
+        size_t size;
+        off_t offset;
+    };
+
+    typedef std::map<FILE*, WriteBehindFile*> Registry;
+
+    static Settings& settings()
+    {
+        static Settings s;
+        return s;
+    }
+
+    static Lock& registryLock()
+    {
+        static Lock lock;
+        return lock;
+    }
+
+    static Registry& registry()
+    {
+        static Registry r;
+        return r;
+    }
+
+    WriteBehindFile(const char* path, uint32_t queueDepth)
+        : m_fp(NULL)
+        , m_path(path)
+        , m_fd(-1)
+        , m_directFd(-1)
+        , m_maxChunks(queueDepth + 1)
+        , m_cond(m_lock)
+        , m_current(NULL)
+        , m_offset(0)
+        , m_size(0)
+        , m_writing(false)
+        , m_quit(false)
+        , m_error(false)
+        , m_threadStarted(false)
+        , m_allocated(0)
+        , m_preallocate(true)
+        , m_bytes(0)
+        , m_writeUs(0)
+        , m_startUs(getMonotonicTimeUs())
+        , m_maxDepth(0)
+        , m_depthSum(0)
+        , m_submits(0)
+    {
+    }
+
+    ~WriteBehindFile()
+    {
+        for (size_t i = 0; i < m_chunks.size(); i++) {
+            free(m_chunks[i].data);
+        }
+    }
+
+    bool init(bool directIO)
+    {
+        m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0) {
+            ERROR("fail to open output file: %s", m_path.c_str());
+            return false;
+        }
+        if (directIO) {
+            m_directFd = ::open(m_path.c_str(), O_WRONLY | O_DIRECT);
+            if (m_directFd < 0)
+                ERROR("%s does not support direct io, use buffered io", m_path.c_str());
+        }
+        //allocate all chunks now, so write() never touches the heap
+        m_chunks.resize(m_maxChunks);
+        for (uint32_t i = 0; i < m_maxChunks; i++) {
+            Chunk& chunk = m_chunks[i];
+            if (posix_memalign((void**)&chunk.data, DIRECT_ALIGNMENT, CHUNK_SIZE)) {
+                chunk.data = NULL;
+                ERROR("failed to allocate write-behind buffer");
+                return false;
+            }
+            chunk.size = 0;
+            chunk.offset = 0;
+            m_free.push_back(&chunk);
+        }
+        if (pthread_create(&m_thread, NULL, start, this)) {
+            ERROR("create writer thread failed");
+            return false;
+        }
+        m_threadStarted = true;
+        return true;
+    }
+
+    //0 on error, fopencookie() wants no negative count, m_error stays set for flush() and close
+    ssize_t write(const char* buf, size_t size)
+    {
+        AutoLock _l(m_lock);
+        size_t left = size;
+        while (left) {
+            if (!m_current) {
+                while (m_free.empty() && !m_error)
+                    m_cond.wait();
+                if (m_error)
+                    return 0;
+                m_current = m_free.back();
+                m_free.pop_back();
+                m_current->size = 0;
+                m_current->offset = m_offset;
+            }
+            size_t n = std::min(left, CHUNK_SIZE - m_current->size);
+            memcpy(m_current->data + m_current->size, buf, n);
+            m_current->size += n;
+            m_offset += n;
+            buf += n;
+            left -= n;
+            if (m_current->size == CHUNK_SIZE)
+                submit();
+        }
+        return m_error ? 0 : (ssize_t)size;
+    }
+
+    int seek(off64_t* pos, int whence)
+    {
+        AutoLock _l(m_lock);
+        submit();
+        off_t offset;
+        switch (whence) {
+        case SEEK_SET:
+            offset = *pos;
+            break;
+        case SEEK_CUR:
+            offset = m_offset + *pos;
+            break;
+        case SEEK_END:
+            waitIdle();
+            offset = m_size + *pos;
+            break;
+        default:
+            return -1;
+        }
+        if (offset < 0)
+            return -1;
+        m_offset = offset;
+        *pos = offset;
+        return 0;
+    }
+
+    bool flush()
+    {
+        AutoLock _l(m_lock);
+        submit();
+        waitIdle();
+        return !m_error;
+    }
+
+    int close()
+    {
+        bool ret = true;
+        if (m_threadStarted) {
+            ret = flush();
+            {
+                AutoLock _l(m_lock);
+                m_quit = true;
+                m_cond.broadcast();
+            }
+            pthread_join(m_thread, NULL);
+            m_threadStarted = false;
+        }
+        if (m_fd >= 0) {
+            //give back what we preallocated
+            if (m_allocated > m_size && ftruncate(m_fd, m_size))
+                ret = false;
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        if (m_directFd >= 0) {
+            ::close(m_directFd);
+            m_directFd = -1;
+        }
+        if (m_bytes)
+            report();
+        return ret ? 0 : -1;
+    }
+
+    //lock must be held
+    void submit()
+    {
+        if (!m_current)
+            return;
+        if (!m_current->size) {
+            m_free.push_back(m_current);
+        }
+        else {
+            m_queue.push_back(m_current);
+            uint32_t depth = m_queue.size();
+            m_maxDepth = std::max(m_maxDepth, depth);
+            m_depthSum += depth;
+            m_submits++;
+        }
+        m_current = NULL;
+        m_cond.broadcast();
+    }
+
+    //lock must be held
+    void waitIdle()
+    {
+        while ((!m_queue.empty() || m_writing) && !m_error)
+            m_cond.wait();
+    }
+
+    static void* start(void* file)
+    {
+        ((WriteBehindFile*)file)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        while (1) {
+            Chunk* chunk;
+            {
+                AutoLock _l(m_lock);
+                while (m_queue.empty() && !m_quit)
+                    m_cond.wait();
+                if (m_queue.empty())
+                    return;
+                chunk = m_queue.front();
+                m_queue.pop_front();
+                m_writing = true;
+            }
+            uint64_t begin = getMonotonicTimeUs();
+            bool ret = writeChunk(*chunk);
+            uint64_t end = getMonotonicTimeUs();
+            AutoLock _l(m_lock);
+            if (!ret)
+                m_error = true;
+            m_size = std::max(m_size, (off_t)(chunk->offset + chunk->size));
+            m_bytes += chunk->size;
+            m_writeUs += end - begin;
+            m_writing = false;
+            m_free.push_back(chunk);
+            m_cond.broadcast();
+        }
+    }
+
+    bool writeChunk(const Chunk& chunk)
+    {
+        off_t end = chunk.offset + chunk.size;
+        if (m_preallocate && end > m_allocated) {
+            off_t size = ALIGN_POW2(end - m_allocated, PREALLOCATE_STEP);
+            if (fallocate(m_fd, 0, m_allocated, size))
+                m_preallocate = false;
+            else
+                m_allocated += size;
+        }
+        size_t direct = 0;
+        if (m_directFd >= 0 && !(chunk.offset % DIRECT_ALIGNMENT))
+            direct = chunk.size & ~(DIRECT_ALIGNMENT - 1);
+        if (direct && !writeAll(m_directFd, chunk.data, direct, chunk.offset))
+            return false;
+        //unaligned tail goes through the page cache
+        return writeAll(m_fd, chunk.data + direct, chunk.size - direct, chunk.offset + direct);
+    }
+
+    bool writeAll(int fd, const uint8_t* data, size_t size, off_t offset)
+    {
+        while (size) {
+            ssize_t n = pwrite(fd, data, size, offset);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                ERROR("write %s failed, errno = %d", m_path.c_str(), errno);
+                return false;
+            }
+            data += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    void report()
+    {
+        double mb = m_bytes / (1024.0 * 1024.0);
+        double diskSeconds = m_writeUs / 1000000.0;
+        double totalSeconds = (getMonotonicTimeUs() - m_startUs) / 1000000.0;
+        fprintf(stderr, "write-behind %s: %.1f MB, %.1f MB/s disk, %.1f MB/s overall, "
+                        "queue depth avg %.1f max %u of %u\n",
+            m_path.c_str(), mb, diskSeconds > 0 ? mb / diskSeconds : 0,
+            totalSeconds > 0 ? mb / totalSeconds : 0,
+            m_submits ? (double)m_depthSum / m_submits : 0, m_maxDepth, m_maxChunks - 1);
+    }
+
+    static ssize_t cookieWrite(void* cookie, const char* buf, size_t size)
+    {
+        return ((WriteBehindFile*)cookie)->write(buf, size);
+    }
+
+    static int cookieSeek(void* cookie, off64_t* pos, int whence)
+    {
+        return ((WriteBehindFile*)cookie)->seek(pos, whence);
+    }
+
+    static int cookieClose(void* cookie)
+    {
+        WriteBehindFile* file = (WriteBehindFile*)cookie;
+        {
+            AutoLock _l(registryLock());
+            registry().erase(file->m_fp);
+        }
+        int ret = file->close();
+        delete file;
+        return ret;
+    }
+
+    FILE* m_fp;
+    std::string m_path;
+    int m_fd;
+    int m_directFd;
+    uint32_t m_maxChunks;
+    std::vector<Chunk> m_chunks;
+
+    Lock m_lock;
+    Condition m_cond;
+    std::vector<Chunk*> m_free;
+    std::deque<Chunk*> m_queue;
+    Chunk* m_current;
+    off_t m_offset;
+    off_t m_size;
+    bool m_writing;
+    bool m_quit;
+    bool m_error;
+    pthread_t m_thread;
+    bool m_threadStarted;
+
+    //only touched by the writer thread
+    off_t m_allocated;
+    bool m_preallocate;
+
+    //stats
+    uint64_t m_bytes;
+    uint64_t m_writeUs;
+    uint64_t m_startUs;
+    uint32_t m_maxDepth;
+    uint64_t m_depthSum;
+    uint64_t m_submits;
+    DISALLOW_COPY_AND_ASSIGN(WriteBehindFile);
+};
+};
+
+#endif //WriteBehindFile_h
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef Y4MHeader_h
+#define Y4MHeader_h
+
+#include "common/log.h"
+#include <VideoCommonDefs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+namespace YamiMediaCodec {
+
+//YUV4MPEG2 stream and frame headers.
+//Frame data of y4m is the same as a raw planar file, so only the headers are handled here,
+//the frame readers and writers move the planes as before.
+class Y4MHeader {
+public:
+    Y4MHeader()
+        : fourcc(YAMI_FOURCC_I420)
+        , width(0)
+        , height(0)
+        , fpsNum(30)
+        , fpsDen(1)
+    {
+    }
+
+    static bool isY4MName(const char* fileName)
+    {
+        const char* ext = fileName ? strrchr(fileName, '.') : NULL;
+        return ext && !strcasecmp(ext, ".y4m");
+    }
+
+    //y4m colorspace tag of fourcc, NULL if y4m can't carry it
+    static const char* colorspace(uint32_t fourcc)
+    {
+        switch (fourcc) {
+        case YAMI_FOURCC_I420:
+            return "420jpeg";
+        case YAMI_FOURCC_422H:
+            return "422";
+        case YAMI_FOURCC_444P:
+            return "444";
+        case YAMI_FOURCC_Y800:
+            return "mono";
+        default:
+            return NULL;
+        }
+    }
+
+    //parse the stream header and leave fp at the first frame header.
+    //return false with fp rewound if this is not a y4m stream
+    bool read(FILE* fp)
+    {
+        char magic[10];
+        if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, "YUV4MPEG2 ", sizeof(magic))) {
+            rewind(fp);
+            return false;
+        }
+        std::string line;
+        if (!readLine(fp, line)) {
+            ERROR("broken y4m stream header");
+            return false;
+        }
+        const char* p = line.c_str();
+        while (*p) {
+            const char* end = strchr(p, ' ');
+            if (!end)
+                end = p + strlen(p);
+            std::string token(p, end);
+            if (!parseToken(token))
+                return false;
+            p = *end ? end + 1 : end;
+        }
+        if (width <= 0 || height <= 0) {
+            ERROR("y4m stream header has no size");
+            return false;
+        }
+        return true;
+    }
+
+    //the stream header line, empty if y4m can't carry the fourcc
+    std::string format() const
+    {
+        const char* cs = colorspace(fourcc);
+        if (!cs) {
+            ERROR("y4m can't carry fourcc %.4s", (const char*)&fourcc);
+            return std::string();
+        }
+        char line[128];
+        snprintf(line, sizeof(line), "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 C%s\n", width, height, fpsNum, fpsDen, cs);
+        return line;
+    }
+
+    //consume "FRAME[ params]\n" in front of a frame, false on eos or garbage
+    static bool readFrame(FILE* fp)
+    {
+        char marker[5];
+        size_t n = fread(marker, 1, sizeof(marker), fp);
+        if (!n)
+            return false;
+        if (n != sizeof(marker) || memcmp(marker, "FRAME", sizeof(marker))) {
+            ERROR("y4m frame header is missing");
+            return false;
+        }
+        std::string params;
+        return readLine(fp, params);
+    }
+
+    static bool writeFrame(FILE* fp)
+    {
+        return fwrite("FRAME\n", 1, 6, fp) == 6;
+    }
+
+    uint32_t fourcc;
+    int width;
+    int height;
+    uint32_t fpsNum;
+    uint32_t fpsDen;
+
+private:
+    bool parseToken(const std::string& token)
+    {
+        if (token.empty())
+            return true;
+        const char* value = token.c_str() + 1;
+        switch (token[0]) {
+        case 'W':
+            width = atoi(value);
+            break;
+        case 'H':
+            height = atoi(value);
+            break;
+        case 'F':
+            if (sscanf(value, "%u:%u", &fpsNum, &fpsDen) != 2 || !fpsNum || !fpsDen) {
+                ERROR("bad y4m frame rate %s", value);
+                return false;
+            }
+            break;
+        case 'C':
+            //420jpeg, 420mpeg2, 420paldv only differ in chroma siting
+            if (!strcmp(value, "420") || !strcmp(value, "420jpeg") || !strcmp(value, "420mpeg2")
+                || !strcmp(value, "420paldv"))
+                fourcc = YAMI_FOURCC_I420;
+            else if (!strcmp(value, "422"))
+                fourcc = YAMI_FOURCC_422H;
+            else if (!strcmp(value, "444"))
+                fourcc = YAMI_FOURCC_444P;
+            else if (!strcmp(value, "mono"))
+                fourcc = YAMI_FOURCC_Y800;
+            else {
+                ERROR("y4m colorspace C%s is not supported", value);
+                return false;
+            }
+            break;
+        case 'I':
+            if (*value != 'p' && *value != '?')
+                ERROR("y4m stream is interlaced, read as progressive");
+            break;
+        default:
+            //aspect ratio and extensions mean nothing to us
+            break;
+        }
+        return true;
+    }
+
+    //read till '\n', the header lines are short
+    static bool readLine(FILE* fp, std::string& line)
+    {
+        line.clear();
+        int c;
+        while ((c = getc(fp)) != EOF) {
+            if (c == '\n')
+                return true;
+            if (line.size() >= MAX_LINE)
+                return false;
+            line += (char)c;
+        }
+        return false;
+    }
+
+    static const size_t MAX_LINE = 1024;
+};
+};
+
+#endif //Y4MHeader_h
@@ -20,6 +20,8 @@
 #include "lock.h"
 
 #include <Yami.h>
+#include <stdint.h>
+#include <time.h>
 
 namespace YamiMediaCodec{
 
@@ -28,7 +30,12 @@ class Condition
 public:
     explicit Condition(Lock& lock):m_lock(lock)
     {
-        pthread_cond_init(&m_cond, NULL);
+        //timedWait() deadlines must not move with the wall clock
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&m_cond, &attr);
+        pthread_condattr_destroy(&attr);
     }
 
     ~Condition()
@@ -41,6 +48,20 @@ public:
         pthread_cond_wait(&m_cond, &m_lock.m_lock);
     }
 
+    //false if nobody woke us within milliseconds
+    bool timedWait(uint32_t milliseconds)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += milliseconds / 1000;
+        ts.tv_nsec += (milliseconds % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        return pthread_cond_timedwait(&m_cond, &m_lock.m_lock, &ts) == 0;
+    }
+
     void signal()
     {
         pthread_cond_signal(&m_cond);
@@ -18,29 +18,152 @@
 #include "VideoCommonDefs.h"
 #include "common/lock.h"
 #include <deque>
+#include <vector>
+#include <new>
+#include <stddef.h>
 
 namespace YamiMediaCodec{
 
+//Keeps the SharedPtr control blocks handed out by a VideoPool.
+//A block goes back to the free list when the last reference of a frame is
+//dropped, so once every buffer has been out once, alloc() does not touch the heap.
+class ControlBlockCache
+{
+public:
+    ControlBlockCache(size_t capacity)
+        : m_blockSize(0)
+    {
+        m_free.reserve(capacity);
+    }
+
+    ~ControlBlockCache()
+    {
+        for (size_t i = 0; i < m_free.size(); i++)
+            ::operator delete(m_free[i]);
+    }
+
+    void* allocate(size_t size)
+    {
+        {
+            AutoLock _l(m_lock);
+            if (!m_blockSize)
+                m_blockSize = size;
+            if (size == m_blockSize && !m_free.empty()) {
+                void* p = m_free.back();
+                m_free.pop_back();
+                return p;
+            }
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* p, size_t size)
+    {
+        {
+            AutoLock _l(m_lock);
+            if (size == m_blockSize && m_free.size() < m_free.capacity()) {
+                m_free.push_back(p);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+private:
+    Lock m_lock;
+    size_t m_blockSize;
+    std::vector<void*> m_free;
+    DISALLOW_COPY_AND_ASSIGN(ControlBlockCache);
+};
+
+//allocator for SharedPtr's control block, backed by ControlBlockCache.
+//It holds a reference of the cache since the control block is released
+//after the deleter, and the deleter may free the pool.
+template <class U>
+class ControlBlockAllocator
+{
+public:
+    typedef U value_type;
+    typedef U* pointer;
+    typedef const U* const_pointer;
+    typedef U& reference;
+    typedef const U& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template <class V>
+    struct rebind {
+        typedef ControlBlockAllocator<V> other;
+    };
+
+    ControlBlockAllocator(const SharedPtr<ControlBlockCache>& cache)
+        : m_cache(cache)
+    {
+    }
+    template <class V>
+    ControlBlockAllocator(const ControlBlockAllocator<V>& other)
+        : m_cache(other.m_cache)
+    {
+    }
+
+    pointer allocate(size_type n, const void* = 0)
+    {
+        return static_cast<pointer>(m_cache->allocate(n * sizeof(U)));
+    }
+    void deallocate(pointer p, size_type n)
+    {
+        m_cache->deallocate(p, n * sizeof(U));
+    }
+    void construct(pointer p, const U& val) { new (p) U(val); }
+    void destroy(pointer p) { p->~U(); }
+    size_type max_size() const { return size_t(-1) / sizeof(U); }
+    pointer address(reference r) const { return &r; }
+    const_pointer address(const_reference r) const { return &r; }
+
+    template <class V>
+    bool operator==(const ControlBlockAllocator<V>& other) const
+    {
+        return m_cache == other.m_cache;
+    }
+    template <class V>
+    bool operator!=(const ControlBlockAllocator<V>& other) const
+    {
+        return m_cache != other.m_cache;
+    }
+
+    SharedPtr<ControlBlockCache> m_cache;
+};
+
 template <class T>
 class VideoPool : public EnableSharedFromThis<VideoPool<T> >
 {
 public:
     VideoPool(std::deque<SharedPtr<T> >& buffers)
+        : m_head(0)
+        , m_count(0)
     {
             m_holder.swap(buffers);
+            m_freed.resize(m_holder.size());
             for (size_t i = 0; i < m_holder.size(); i++) {
-                m_freed.push_back(m_holder[i].get());
+                m_freed[m_count++] = m_holder[i].get();
             }
+            m_cache.reset(new ControlBlockCache(m_holder.size()));
     }
 
     SharedPtr<T> alloc()
     {
         SharedPtr<T> ret;
         AutoLock _l(m_lock);
-        if (!m_freed.empty()) {
-            T* p = m_freed.front();
-            m_freed.pop_front();
+        if (m_count) {
+            T* p = m_freed[m_head];
+            m_head = (m_head + 1) % m_freed.size();
+            m_count--;
+#if __cplusplus > 199711L
+            ret.reset(p, Recycler(this->shared_from_this()),
+                ControlBlockAllocator<T>(m_cache));
+#else
+            //tr1::shared_ptr can't take an allocator
             ret.reset(p, Recycler(this->shared_from_this()));
+#endif
         }
         return ret;
     }
@@ -50,7 +173,8 @@ private:
     void recycle(T* ptr)
     {
         AutoLock _l(m_lock);
-        m_freed.push_back(ptr);
+        m_freed[(m_head + m_count) % m_freed.size()] = ptr;
+        m_count++;
     }
 
     class Recycler
@@ -69,8 +193,12 @@ private:
     };
 
     Lock m_lock;
-    std::deque<T*> m_freed;
+    //ring of free buffers, never grows after construction
+    std::vector<T*> m_freed;
+    size_t m_head;
+    size_t m_count;
     std::deque<SharedPtr<T> > m_holder;
+    SharedPtr<ControlBlockCache> m_cache;
 };
 
 };
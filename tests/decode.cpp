@@ -21,6 +21,7 @@
 #include "vppinputdecode.h"
 #include "decodeoutput.h"
 #include "decodehelp.h"
+#include "pipelinestages.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -53,6 +54,35 @@ SharedPtr<VppInput> createInput(DecodeParameter& para, SharedPtr<NativeDisplay>&
     return input;
 }
 
+class DecodeOutputStage : public TracedStage {
+public:
+    DecodeOutputStage(const SharedPtr<DecodeOutput>& output, const SharedPtr<FrameQueue>& input)
+        : TracedStage("output")
+        , m_output(output)
+        , m_input(input)
+    {
+    }
+    bool run()
+    {
+        FpsCalc fps;
+        SharedPtr<VideoFrame> frame;
+        while (pop(*m_input, frame)) {
+            int64_t id = tracing() ? restore(frame->timeStamp) : frame->timeStamp;
+            if (!m_output->output(frame))
+                return false;
+            stamp(id, TRACE_OUTPUT);
+            addItem();
+            fps.addFrame();
+        }
+        fps.log();
+        return true;
+    }
+
+private:
+    SharedPtr<DecodeOutput> m_output;
+    SharedPtr<FrameQueue> m_input;
+};
+
 class DecodeTest {
 public:
     bool init(int argc, char** argv)
@@ -61,7 +91,8 @@ public:
             fprintf(stderr, "process arguments failed.\n");
             return false;
         }
-        m_output.reset(DecodeOutput::create(m_params.renderMode, m_params.renderFourcc, m_params.inputFile, m_params.outputFile.c_str()));
+        m_output.reset(DecodeOutput::create(m_params.renderMode, m_params.renderFourcc, m_params.inputFile, m_params.outputFile.c_str(),
+            m_params.maxWidth, m_params.maxHeight, m_params.digest, m_params.digestTree, m_params.digestThreads, m_params.golden));
         if (!m_output) {
             fprintf(stderr, "DecodeOutput::create failed.\n");
             return false;
@@ -75,24 +106,25 @@ public:
         }
         return true;
     }
+    //decoding and output run on their own threads
     bool run()
     {
-        FpsCalc fps;
-        SharedPtr<VideoFrame> src;
-        uint32_t count = 0;
-        while (m_vppInput->read(src)) {
-            if (!m_output->output(src))
-                break;
-            count++;
-            fps.addFrame();
-            if (count == m_params.renderFrames)
-                break;
-        }
-        fps.log();
+        Pipeline pipeline;
+        SharedPtr<FrameQueue> decoded = pipeline.createQueue<SharedPtr<VideoFrame> >(FRAME_QUEUE_DEPTH);
+        SharedPtr<InputStage> input(new InputStage(m_vppInput, decoded, m_params.renderFrames));
+        SharedPtr<DecodeOutputStage> output(new DecodeOutputStage(m_output, decoded));
+        SharedPtr<FrameTrace> trace = createFrameTrace();
+        input->addTrace(trace);
+        output->addTrace(trace);
+        pipeline.add(input, decoded);
+        pipeline.add(output);
+        pipeline.run();
+        trace->report("pipeline");
+        bool ret = m_output->finish(input->eos());
 
         possibleWait(m_vppInput->getMimeType(), &m_params);
 
-        return true;
+        return ret;
     }
 
 private:
@@ -107,6 +139,5 @@ int main(int argc, char* argv[])
     DecodeTest decode;
     if (!decode.init(argc, argv))
         return 1;
-    decode.run();
-    return 0;
+    return decode.run() ? 0 : 1;
 }
@@ -20,6 +20,9 @@
 #include "decodehelp.h"
 
 #include "common/utils.h"
+#include "common/CompressedFrameFile.h"
+#include "common/CpuAffinity.h"
+#include "common/WriteBehindFile.h"
 
 #include <ctype.h>
 #include <limits.h>
@@ -38,10 +41,11 @@ static void printHelp(const char* app)
     printf("   -i media file to decode\n");
     printf("   -w wait before quit: 0:no-wait, 1:auto(jpeg wait), 2:wait\n");
     printf("   -f dumped fourcc [*]\n");
-    printf("   -o dumped output dir\n");
+    printf("   -o dumped output dir, or file, a .y4m file gets a y4m header\n");
     printf("   -n specify how many frames to be decoded\n");
     printf("   -m <render mode>\n");
-    printf("     -2: print MD5 by per frame and the whole decoded file MD5\n");
+    printf("     -3: compare frames with a reference and stop at the first difference, see --golden\n");
+    printf("     -2: print digest by per frame and the whole decoded file digest, see --digest\n");
     printf("     -1: skip video rendering [*]\n");
     printf("      0: dump video frame to file [*]\n");
     printf("      1: render to X window [*]\n");
@@ -56,12 +60,24 @@ static void printHelp(const char* app)
     printf("      0: decode all layers\n");
     printf("    N>0: decode the first N layers\n");
     printf("  --lowlatency: if set this flag to true, AVC decoder will output the ready frames ASAP\n");
+    printf("  --max-resolution <WxH>: reserve dump/md5 surfaces at WxH, resolution changes up to it do not reallocate\n");
+    printf("  --affinity <node:N | cpu list like 0-3,8>: pin threads there and allocate host buffers on that numa node\n");
+    printf("  --digest <md5|xxh3|crc32c>: digest for render mode -2, default md5, xxh3 and crc32c are faster\n");
+    printf("  --digest-threads <n>: hash frames of render mode -2 on n threads while decoding goes on, default 0\n");
+    printf("  --digest-tree: take the render mode -2 file digest over the frame digest lines instead of hashing the frames\n");
+    printf("      again, the digest of all but the last line of the output. without it the file digest is hashed on one thread\n");
+    printf("  --write-behind <n>: queue n 4M buffers for a writer thread when dumping, default 0, write in place\n");
+    printf("  --direct-io: bypass page cache for write-behind output\n");
+    printf("  --compress <%s>: compress dumped frames one by one on worker threads, yamivpp and psnr read them back,\n"
+           "      not with --write-behind or --direct-io\n",
+        CompressedFrameFile::codecs());
 }
 
 bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
 {
     int32_t option_index;
     bool isSetFourcc = false;
+    bool isSetRenderMode = false;
     std::string outputFile;
     parameters->renderFrames = UINT_MAX;
     parameters->waitBeforeQuit = 1;
@@ -72,12 +88,28 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
     parameters->spacialLayer = 0;
     parameters->qualityLayer = 0;
     parameters->enableLowLatency = false;
+    parameters->maxWidth = 0;
+    parameters->maxHeight = 0;
+    parameters->digest = NULL;
+    parameters->digestTree = false;
+    parameters->digestThreads = 0;
+    parameters->golden = NULL;
+    parameters->affinity = NULL;
 
     const struct option long_opts[] = {
         { "help", no_argument, NULL, 'h' },
         { "capi", no_argument, NULL, 0 },
         { "temporal-layer", required_argument, NULL, 0 },
         { "lowlatency", no_argument, 0, 0 },
+        { "max-resolution", required_argument, NULL, 0 },
+        { "affinity", required_argument, NULL, 0 },
+        { "write-behind", required_argument, NULL, 0 },
+        { "direct-io", no_argument, NULL, 0 },
+        { "digest", required_argument, NULL, 0 },
+        { "digest-threads", required_argument, NULL, 0 },
+        { "compress", required_argument, NULL, 0 },
+        { "golden", required_argument, NULL, 0 },
+        { "digest-tree", no_argument, NULL, 0 },
         { NULL, no_argument, NULL, 0 }
     };
 
@@ -96,6 +128,7 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
             break;
         case 'm':
             parameters->renderMode = atoi(optarg);
+            isSetRenderMode = true;
             break;
         case 'n':
             parameters->renderFrames = atoi(optarg);
@@ -124,6 +157,44 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
             case 3:
                 parameters->enableLowLatency = true;
                 break;
+            case 4:
+                if (sscanf(optarg, "%dx%d", &parameters->maxWidth, &parameters->maxHeight) != 2
+                    || parameters->maxWidth <= 0 || parameters->maxHeight <= 0) {
+                    fprintf(stderr, "invalid max resolution: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 5:
+                parameters->affinity = optarg;
+                break;
+            case 6:
+                WriteBehindFile::setQueueDepth(atoi(optarg));
+                break;
+            case 7:
+                WriteBehindFile::setDirectIO(true);
+                break;
+            case 8:
+                parameters->digest = optarg;
+                break;
+            case 9: {
+                int threads = atoi(optarg);
+                if (threads < 0 || threads > 64) {
+                    fprintf(stderr, "invalid digest threads: %s\n", optarg);
+                    return false;
+                }
+                parameters->digestThreads = threads;
+                break;
+            }
+            case 10:
+                if (!CompressedFrameFile::setCompression(optarg, 0))
+                    return false;
+                break;
+            case 11:
+                parameters->golden = optarg;
+                break;
+            case 12:
+                parameters->digestTree = true;
+                break;
             default:
                 printHelp(argv[0]);
                 break;
@@ -148,6 +219,25 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
         fprintf(stderr, "no input media file specified.\n");
         return false;
     }
+    //--golden means render mode -3, whatever order the options come in
+    if (parameters->golden) {
+        if (isSetRenderMode && parameters->renderMode != -3) {
+            fprintf(stderr, "--golden is render mode -3, it can't be used with -m %d\n", parameters->renderMode);
+            return false;
+        }
+        parameters->renderMode = -3;
+    }
+    //compressed output has its own writer, it would not use them
+    if (CompressedFrameFile::enabled() && WriteBehindFile::requested()) {
+        fprintf(stderr, "--compress can't be used with --write-behind or --direct-io\n");
+        return false;
+    }
+    //before any thread starts, they all inherit it
+    if (parameters->affinity) {
+        CpuAffinity affinity;
+        if (!affinity.parse(parameters->affinity) || !affinity.apply())
+            return false;
+    }
     if (outputFile.empty())
         outputFile = "./";
     parameters->outputFile = outputFile;
@@ -35,6 +35,21 @@ typedef struct DecodeParameter {
 
     //if set this flag to true, AVC decoder will output the ready frames ASAP.
     bool enableLowLatency;
+
+    //reserve output surfaces at this size, 0 means the size of the first frame
+    int maxWidth;
+    int maxHeight;
+
+    //digest for render mode -2, NULL for default
+    const char* digest;
+    //render mode -2 file digest over the frame digest lines
+    bool digestTree;
+    //hash threads for render mode -2, 0 hashes on the decoding thread
+    uint32_t digestThreads;
+    //reference of render mode -3, yuv or a digest list
+    const char* golden;
+    //--affinity, applied once all options are parsed
+    const char* affinity;
 } StreamParameter;
 
 bool processCmdLine(int argc, char** argv, DecodeParameter* parameters);
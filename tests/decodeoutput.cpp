@@ -21,17 +21,13 @@
 #include "decodeoutput.h"
 #include "common/log.h"
 #include "common/VaapiUtils.h"
+#include "common/VaapiMappedImage.h"
+#include "common/MaxResolutionFrameAllocator.h"
+#include "common/FrameDigest.h"
+#include "common/CompressedFrameFile.h"
+#include "common/Y4MHeader.h"
+#include "common/ThreadPool.h"
 
-#if __ENABLE_MD5__
-// including bsd/md5.h produces a warning with __bounded__ attribute,
-// libyami-utils chooses to ignore this particular warning by pushing the
-// current environment, ignoring attributes and then poping to restore the
-// environment.
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wattributes"
-#include <bsd/md5.h>
-#pragma GCC diagnostic pop
-#endif
 
 #ifdef __ENABLE_X11__
 #include <X11/Xlib.h>
@@ -49,11 +45,13 @@
 
 #include <va/va.h>
 #include <va/va_drmcommon.h>
+#include <deque>
 #include <vector>
 #include <sys/stat.h>
 #include <sstream>
 #include <stdio.h>
 #include <assert.h>
+#include <ctype.h>
 
 using namespace YamiMediaCodec;
 using std::vector;
@@ -67,6 +65,14 @@ struct VADisplayTerminator {
     }
 };
 
+DecodeOutput::DecodeOutput()
+    : m_width(0)
+    , m_height(0)
+    , m_maxWidth(0)
+    , m_maxHeight(0)
+{
+}
+
 bool DecodeOutput::init()
 {
     m_nativeDisplay.reset(new NativeDisplay);
@@ -84,6 +90,11 @@ SharedPtr<NativeDisplay> DecodeOutput::nativeDisplay()
     return m_nativeDisplay;
 }
 
+bool DecodeOutput::finish(bool /*eos*/)
+{
+    return true;
+}
+
 bool DecodeOutput::setVideoSize(uint32_t with, uint32_t height)
 {
     m_width = with;
@@ -113,21 +124,54 @@ bool DecodeOutputNull::output(const SharedPtr<VideoFrame>& frame)
     return checkVaapiStatus(status, "vaSyncSurface");
 }
 
+//receives a frame row by row, plane by plane
+class RowSink {
+public:
+    virtual void onRow(const uint8_t* data, uint32_t size) = 0;
+    virtual ~RowSink() {}
+};
+
+//visible planes of a mapped frame
+struct MappedFrame {
+    //holds the frame mapped while we read it, unmapped with the last copy
+    SharedPtr<VaapiMappedImage> image;
+    uint32_t planes;
+    const uint8_t* data[3];
+    uint32_t width[3];
+    uint32_t height[3];
+    uint32_t pitch[3];
+
+    void feed(RowSink& sink) const
+    {
+        for (uint32_t i = 0; i < planes; i++) {
+            const uint8_t* row = data[i];
+            for (uint32_t h = 0; h < height[i]; h++) {
+                sink.onRow(row, width[i]);
+                row += pitch[i];
+            }
+        }
+    }
+};
+
 class ColorConvert {
 public:
-    ColorConvert(const SharedPtr<VADisplay>& display, uint32_t fourcc)
+    //copy: convert even when the fourcc matches, so decoder surfaces are returned at once,
+    //poolSize must cover all converted frames held by caller then
+    ColorConvert(const SharedPtr<VADisplay>& display, uint32_t fourcc, int maxWidth = 0, int maxHeight = 0,
+        int poolSize = 3, bool copy = false)
         : m_width(0)
         , m_height(0)
         , m_destFourcc(fourcc)
+        , m_copy(copy)
         , m_display(display)
-
     {
-        m_allocator.reset(new PooledFrameAllocator(m_display, 3));
+        SharedPtr<FrameAllocator> allocator(new MappedFrameAllocator(m_display, poolSize));
+        m_allocator = reserveMaxResolution(allocator, maxWidth, maxHeight);
     }
     SharedPtr<VideoFrame> convert(const SharedPtr<VideoFrame>& src)
     {
 
-        if (src->fourcc == m_destFourcc)
+        if (src->fourcc == m_destFourcc && !m_copy)
             return src;
 
         SharedPtr<VideoFrame> dest;
@@ -138,6 +182,10 @@ public:
             return dest;
         }
         dest = m_allocator->alloc();
+        if (!dest) {
+            ERROR("no free surface in convert pool");
+            return dest;
+        }
         YamiStatus status = m_vpp->process(src, dest);
         if (status != YAMI_SUCCESS) {
             ERROR("vpp process return %d", status);
@@ -145,48 +193,48 @@ public:
         }
         return dest;
     }
-    //collect all bytes to dest
-    bool convert(vector<uint8_t>& dest, const SharedPtr<VideoFrame>& frame)
+    //convert and map the frame, the mapping stays valid while mapped.image is held
+    bool map(MappedFrame& mapped, const SharedPtr<VideoFrame>& frame)
     {
         SharedPtr<VideoFrame> src = convert(frame);
         if (!src)
             return false;
-        dest.clear();
-        VAImage image;
-        uint8_t* p = mapSurfaceToImage(*m_display, src->surface, image);
+        SharedPtr<VaapiMappedImage> mapping(new VaapiMappedImage(*m_display));
+        uint8_t* p = mapping->map(src);
         if (!p) {
             ERROR("failed to map VAImage");
             return false;
         }
+        const VAImage& image = mapping->image();
 
-        uint32_t planes, width[3], height[3];
         uint32_t xByte[3], yByte[3];
-        if (!getPlaneResolution(src->fourcc, src->crop.width, src->crop.height, width, height, planes)) {
+        if (!getPlaneResolution(src->fourcc, src->crop.width, src->crop.height, mapped.width, mapped.height, mapped.planes)) {
             ERROR("get plane reoslution failed");
             return false;
         }
-        if (!getPlaneResolution(src->fourcc, src->crop.x, src->crop.y, xByte, yByte, planes)) {
+        if (!getPlaneResolution(src->fourcc, src->crop.x, src->crop.y, xByte, yByte, mapped.planes)) {
             ERROR("get left-top coordinate failed");
             return false;
         }
-        for (uint32_t i = 0; i < planes; i++) {
-            copyPlane(dest, p, image.offsets[i] + yByte[i] * image.pitches[i], width[i], height[i], image.pitches[i], xByte[i]);
+        for (uint32_t i = 0; i < mapped.planes; i++) {
+            mapped.data[i] = p + image.offsets[i] + yByte[i] * image.pitches[i] + xByte[i];
+            mapped.pitch[i] = image.pitches[i];
         }
-        unmapImage(*m_display, image);
+        mapped.image = mapping;
         return true;
     }
-
-private:
-    static void copyPlane(std::vector<uint8_t>& v, uint8_t* data, uint32_t offset, uint32_t width,
-        uint32_t height, uint32_t pitch, uint32_t widthOffset)
+    //feed all visible rows to sink, straight from the mapped surface
+    bool convert(RowSink& sink, const SharedPtr<VideoFrame>& frame)
     {
-        data += offset;
-        for (uint32_t h = 0; h < height; h++) {
-            v.insert(v.end(), data + widthOffset, data + width + widthOffset);
-            data += pitch;
-        }
+        MappedFrame mapped;
+        if (!map(mapped, frame))
+            return false;
+        mapped.feed(sink);
+        return true;
     }
 
+private:
+
     bool init(uint32_t width, uint32_t height)
     {
         if (m_width != width || m_height != height) {
@@ -210,6 +258,7 @@ private:
     uint32_t m_width;
     uint32_t m_height;
     uint32_t m_destFourcc;
+    bool m_copy;
     SharedPtr<VADisplay> m_display;
     SharedPtr<FrameAllocator> m_allocator;
     SharedPtr<IVideoPostProcess> m_vpp;
@@ -238,7 +287,7 @@ bool DecodeOutputFile::init()
     m_vaDisplay = createVADisplay();
     if (!m_vaDisplay)
         return false;
-    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc));
+    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_maxWidth, m_maxHeight));
     return DecodeOutput::init();
 }
 
@@ -295,7 +344,7 @@ void DecodeOutputDump::resetConvert(uint32_t fourcc)
     else {
         m_destFourcc = fourcc;
     }
-    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc));
+    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_maxWidth, m_maxHeight));
 }
 
 bool DecodeOutputDump::initOutput(const SharedPtr<VideoFrame>& frame)
@@ -310,7 +359,14 @@ bool DecodeOutputDump::initOutput(const SharedPtr<VideoFrame>& frame)
             ERROR("maybe you set a wrong extension");
             return false;
         }
-        SharedPtr<FrameWriter> writer(new VaapiFrameWriter(m_vaDisplay));
+        //y4m picks its own fourcc
+        uint32_t fourcc;
+        int w, h;
+        if (m_output->getFormat(fourcc, w, h) && fourcc != m_destFourcc) {
+            m_destFourcc = fourcc;
+            m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_maxWidth, m_maxHeight));
+        }
+        SharedPtr<FrameWriter> writer(new VaapiConvertFrameWriter(m_vaDisplay, m_destFourcc, CpuColorConvert::defaultThreads()));
         if (!outputFile->config(writer)) {
             ERROR("config writer failed");
             return false;
@@ -328,36 +384,201 @@ bool DecodeOutputDump::output(const SharedPtr<VideoFrame>& frame)
 {
     if (!initOutput(frame))
         return false;
+    //the writer converts on the mapped surface when it can, vpp does the rest
+    if (CpuColorConvert::isSupported(frame->fourcc, m_destFourcc))
+        return m_output->output(frame);
     SharedPtr<VideoFrame> dest = m_convert->convert(frame);
     return m_output->output(dest);
 }
 
-#if __ENABLE_MD5__
-class DecodeOutputMD5 : public DecodeOutputFile {
+class DigestSink : public RowSink {
 public:
-    DecodeOutputMD5(const char* outputFile, const char* inputFile, uint32_t fourcc)
+    DigestSink(FrameDigest& digest)
+        : m_digest(digest)
+    {
+    }
+    void onRow(const uint8_t* data, uint32_t size) { m_digest.update(data, size); }
+
+private:
+    FrameDigest& m_digest;
+};
+
+//the file digest of tree mode, over the frame digests as the lines of the output file
+static void feedLine(FrameDigest& fileDigest, const std::string& frameDigest)
+{
+    std::string line = frameDigest + "\n";
+    fileDigest.update((const uint8_t*)line.data(), line.size());
+}
+
+//Hashes mapped frames on a ThreadPool while the decoder goes on.
+//Each frame is a Future computing its digest, the workers finish them in any
+//order. The thread submitting frames feeds the file digest and writes the frame
+//digests from the oldest future on, both in frame order, so the output is the
+//same as hashing on the decoding thread.
+//Hashing all frames again for the file digest is serial and caps the speed at one
+//thread, unless tree is set and the file digest is taken over the frame digest lines.
+class DigestWorkers {
+public:
+    DigestWorkers(FILE* file, const SharedPtr<FrameDigest>& fileDigest, bool tree, uint32_t threads)
+        : m_file(file)
+        , m_fileDigest(fileDigest)
+        , m_tree(tree)
+        , m_pool(threads)
+        , m_slots(0)
+    {
+    }
+    ~DigestWorkers();
+    //slots is the number of frames in flight, the caller must be able to hold that many
+    bool init(const char* digest, uint32_t slots);
+    //retires the oldest frame first if all slots are busy
+    void submit(const MappedFrame& frame);
+    //retire all submitted frames
+    void drain();
+
+private:
+    class HashTask : public Future<std::string> {
+    public:
+        HashTask(const MappedFrame& frame, const SharedPtr<FrameDigest>& digest)
+            : frame(frame)
+            , digest(digest)
+        {
+        }
+        MappedFrame frame;
+        SharedPtr<FrameDigest> digest;
+
+    private:
+        std::string compute()
+        {
+            digest->reset();
+            DigestSink sink(*digest);
+            frame.feed(sink);
+            return digest->final();
+        }
+    };
+
+    //file digest and frame digest line of the oldest frame, then unmap it
+    void retire();
+
+    FILE* m_file;
+    SharedPtr<FrameDigest> m_fileDigest;
+    bool m_tree;
+    ThreadPool m_pool;
+    uint32_t m_slots;
+    //in frame order
+    std::deque<SharedPtr<HashTask> > m_pending;
+    //digests of the free slots
+    std::vector<SharedPtr<FrameDigest> > m_digests;
+    DISALLOW_COPY_AND_ASSIGN(DigestWorkers);
+};
+
+bool DigestWorkers::init(const char* digest, uint32_t slots)
+{
+    m_slots = slots;
+    for (uint32_t i = 0; i < slots; i++) {
+        SharedPtr<FrameDigest> frameDigest = FrameDigest::create(digest);
+        if (!frameDigest)
+            return false;
+        m_digests.push_back(frameDigest);
+    }
+    return true;
+}
+
+void DigestWorkers::submit(const MappedFrame& frame)
+{
+    if (m_pending.size() == m_slots)
+        retire();
+    SharedPtr<HashTask> task(new HashTask(frame, m_digests.back()));
+    m_digests.pop_back();
+    m_pending.push_back(task);
+    m_pool.submit(task);
+}
+
+void DigestWorkers::retire()
+{
+    SharedPtr<HashTask> task = m_pending.front();
+    m_pending.pop_front();
+    if (m_tree) {
+        feedLine(*m_fileDigest, task->get());
+    }
+    else {
+        //reads the frame together with the hash worker
+        DigestSink sink(*m_fileDigest);
+        task->frame.feed(sink);
+    }
+    fprintf(m_file, "%s\n", task->get().c_str());
+    m_digests.push_back(task->digest);
+    //unmap and give the surface back to the pool
+    task->frame = MappedFrame();
+}
+
+void DigestWorkers::drain()
+{
+    while (!m_pending.empty())
+        retire();
+}
+
+DigestWorkers::~DigestWorkers()
+{
+    drain();
+}
+
+//per frame digests and the digest of all frames, md5 by default
+class DecodeOutputDigest : public DecodeOutputFile, private RowSink {
+public:
+    //tree: the file digest is over the frame digest lines, not over the frames again.
+    //threads: hash on this many worker threads, 0 to hash on the decoding thread
+    DecodeOutputDigest(const char* outputFile, const char* inputFile, uint32_t fourcc, const SharedPtr<FrameDigest>& frameDigest,
+        const SharedPtr<FrameDigest>& fileDigest, bool tree, uint32_t threads)
         : DecodeOutputFile(outputFile, inputFile, fourcc)
         , m_file(NULL)
+        , m_frameDigest(frameDigest)
+        , m_fileDigest(fileDigest)
+        , m_tree(tree)
+        , m_threads(threads)
     {
     }
-    virtual ~DecodeOutputMD5();
+    virtual ~DecodeOutputDigest();
+    bool init();
 
 protected:
     bool setVideoSize(uint32_t width, uint32_t height);
     bool output(const SharedPtr<VideoFrame>& frame);
 
 private:
+    //frames in flight, one for each worker plus some queued
+    uint32_t slots() const { return m_threads + 2; }
+    void resetConvert();
     std::string getOutputFileName(uint32_t width, uint32_t height);
-    std::string writeToFile(MD5_CTX&);
+    std::string writeToFile(FrameDigest&);
+    void onRow(const uint8_t* data, uint32_t size);
 
     FILE* m_file;
-    static MD5_CTX m_fileMD5;
-    vector<uint8_t> m_data;
+    SharedPtr<FrameDigest> m_frameDigest;
+    SharedPtr<FrameDigest> m_fileDigest;
+    bool m_tree;
+    uint32_t m_threads;
+    SharedPtr<DigestWorkers> m_workers;
 };
 
-MD5_CTX DecodeOutputMD5::m_fileMD5 = { 0 };
+bool DecodeOutputDigest::init()
+{
+    if (!DecodeOutputFile::init())
+        return false;
+    resetConvert();
+    return true;
+}
+
+void DecodeOutputDigest::resetConvert()
+{
+    if (!m_threads) {
+        m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_maxWidth, m_maxHeight));
+        return;
+    }
+    //copy even when no conversion is needed, the workers hold frames and the decoder wants its surfaces back
+    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_maxWidth, m_maxHeight, slots() + 1, true));
+}
 
-std::string DecodeOutputMD5::getOutputFileName(uint32_t width, uint32_t height)
+std::string DecodeOutputDigest::getOutputFileName(uint32_t width, uint32_t height)
 {
     std::ostringstream name;
 
@@ -369,11 +590,11 @@ std::string DecodeOutputMD5::getOutputFileName(uint32_t width, uint32_t height)
         const char* s = strrchr(m_inputFile, '/');
         if (s)
             fileName = s + 1;
-        name << "/" << fileName << ".md5";
+        name << "/" << fileName << "." << m_frameDigest->name();
     }
     return name.str();
 }
-bool DecodeOutputMD5::setVideoSize(uint32_t width, uint32_t height)
+bool DecodeOutputDigest::setVideoSize(uint32_t width, uint32_t height)
 {
     if (!m_file) {
         std::string name = getOutputFileName(width, height);
@@ -382,59 +603,286 @@ bool DecodeOutputMD5::setVideoSize(uint32_t width, uint32_t height)
             //ERROR("fail to open input file: %s", name.c_str());
             return false;
         }
-        MD5Init(&m_fileMD5);
-        return true;
+        m_fileDigest->reset();
+        if (m_threads) {
+            m_workers.reset(new DigestWorkers(m_file, m_fileDigest, m_tree, m_threads));
+            if (!m_workers->init(m_frameDigest->name(), slots()))
+                return false;
+        }
     }
     return DecodeOutputFile::setVideoSize(width, height);
 }
 
-std::string DecodeOutputMD5::writeToFile(MD5_CTX& t_ctx)
+std::string DecodeOutputDigest::writeToFile(FrameDigest& digest)
 {
-    char temp[4];
-    uint8_t result[16] = { 0 };
-    std::string strMD5;
-    MD5Final(result, &t_ctx);
-    for(uint32_t i = 0; i < 16; i++) {
-        memset(temp, 0, sizeof(temp));
-        snprintf(temp, sizeof(temp), "%02x", (uint32_t)result[i]);
-        strMD5 += temp;
-    }
+    std::string str = digest.final();
     if (m_file)
-        fprintf(m_file, "%s\n", strMD5.c_str());
-    return strMD5;
+        fprintf(m_file, "%s\n", str.c_str());
+    return str;
 }
 
-DecodeOutputMD5::~DecodeOutputMD5()
+DecodeOutputDigest::~DecodeOutputDigest()
 {
+    //finish the pending frames before the file digest
+    m_workers.reset();
     if (m_file) {
-        fprintf(m_file, "The whole frames MD5 ");
-        std::string fileMd5 = writeToFile(m_fileMD5);
-        fprintf(stderr, "The whole frames MD5:\n%s\n", fileMd5.c_str());
+        const char* name = m_fileDigest->name();
+        //not the same digest as without tree, so not the same name either
+        const char* what = m_tree ? "The frame list" : "The whole frames";
+        fprintf(m_file, "%s %s ", what, name);
+        std::string fileDigest = writeToFile(*m_fileDigest);
+        fprintf(stderr, "%s %s:\n%s\n", what, name, fileDigest.c_str());
         fclose(m_file);
     }
 }
 
-bool DecodeOutputMD5::output(const SharedPtr<VideoFrame>& frame)
+void DecodeOutputDigest::onRow(const uint8_t* data, uint32_t size)
+{
+    m_frameDigest->update(data, size);
+    if (!m_tree)
+        m_fileDigest->update(data, size);
+}
+
+bool DecodeOutputDigest::output(const SharedPtr<VideoFrame>& frame)
 {
+    //converter reallocates its surfaces on size change, workers may still read the old ones
+    if (m_workers && (frame->crop.width != m_width || frame->crop.height != m_height))
+        m_workers->drain();
     if (!setVideoSize(frame->crop.width, frame->crop.height))
         return false;
-    if (frame->fourcc == YAMI_FOURCC_P010)
-        m_convert.reset(new ColorConvert(m_vaDisplay, YAMI_FOURCC_P010));
+    if (frame->fourcc == YAMI_FOURCC_P010 && m_destFourcc != YAMI_FOURCC_P010) {
+        if (m_workers)
+            m_workers->drain();
+        m_destFourcc = YAMI_FOURCC_P010;
+        resetConvert();
+    }
+
+    if (m_workers) {
+        MappedFrame mapped;
+        if (!m_convert->map(mapped, frame))
+            return false;
+        m_workers->submit(mapped);
+        return true;
+    }
+    m_frameDigest->reset();
+    if (!m_convert->convert(*this, frame))
+        return false;
+    std::string frameDigest = writeToFile(*m_frameDigest);
+    if (m_tree)
+        feedLine(*m_fileDigest, frameDigest);
+
+    return true;
+}
+
+//Compare each frame with a reference while decoding, stop at the first difference.
+//The reference is a raw or y4m yuv file, compressed or not, or a digest list written by render mode -2.
+class DecodeOutputCompare : public DecodeOutputFile {
+public:
+    DecodeOutputCompare(const char* reference, const char* inputFile, uint32_t fourcc)
+        : DecodeOutputFile(reference, inputFile, fourcc)
+        , m_file(NULL)
+        , m_y4m(false)
+        , m_y4mWidth(0)
+        , m_y4mHeight(0)
+        , m_frames(0)
+        , m_failed(false)
+    {
+    }
+    virtual ~DecodeOutputCompare();
+    bool init();
+    bool finish(bool eos);
+
+protected:
+    bool output(const SharedPtr<VideoFrame>& frame);
+
+private:
+    bool readDigests();
+    bool compareDigest(const SharedPtr<VideoFrame>& frame);
+    bool compareFrame(const SharedPtr<VideoFrame>& frame);
+    bool fail();
+
+    FILE* m_file;
+    bool m_y4m;
+    int m_y4mWidth;
+    int m_y4mHeight;
+    //digest list mode if m_digest is set
+    SharedPtr<FrameDigest> m_digest;
+    std::vector<std::string> m_digests;
+    std::vector<uint8_t> m_reference;
+    uint32_t m_frames;
+    bool m_failed;
+};
+
+DecodeOutputCompare::~DecodeOutputCompare()
+{
+    if (m_file)
+        fclose(m_file);
+}
+
+bool DecodeOutputCompare::init()
+{
+    if (!DecodeOutputFile::init())
+        return false;
+    m_file = CompressedFrameFile::open(m_outputFile);
+    if (!m_file) {
+        fprintf(stderr, "can't open reference %s\n", m_outputFile);
+        return false;
+    }
+    if (readDigests()) {
+        fclose(m_file);
+        m_file = NULL;
+        return bool(m_digest);
+    }
+    Y4MHeader y4m;
+    if (y4m.read(m_file)) {
+        m_y4m = true;
+        m_y4mWidth = y4m.width;
+        m_y4mHeight = y4m.height;
+        m_destFourcc = y4m.fourcc;
+    }
+    else {
+        m_destFourcc = guessFourcc(m_outputFile);
+    }
+    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_maxWidth, m_maxHeight));
+    return true;
+}
 
-    if (!m_convert->convert(m_data, frame))
+//a digest list has one hex digest per line, the digest is known by its length.
+//return false with m_file rewound if this is not a digest list
+bool DecodeOutputCompare::readDigests()
+{
+    char line[128];
+    while (fgets(line, sizeof(line), m_file)) {
+        size_t len = strlen(line);
+        while (len && isspace(line[len - 1]))
+            line[--len] = '\0';
+        size_t hex = 0;
+        while (hex < len && isxdigit(line[hex]))
+            hex++;
+        //"The whole frames md5 ..." ends the list
+        if (!len || hex != len)
+            break;
+        m_digests.push_back(line);
+    }
+    const char* name = NULL;
+    if (!m_digests.empty()) {
+        switch (m_digests[0].size()) {
+        case 32:
+            name = "md5";
+            break;
+        case 16:
+            name = "xxh3";
+            break;
+        case 8:
+            name = "crc32c";
+            break;
+        }
+    }
+    if (!name) {
+        m_digests.clear();
+        rewind(m_file);
         return false;
+    }
+    m_digest = FrameDigest::create(name);
+    if (!m_digest)
+        fprintf(stderr, "%s is a %s list, but %s is not built in\n", m_outputFile, name, name);
+    return true;
+}
 
-    MD5_CTX frameMD5;
-    MD5Init(&frameMD5);
-    MD5Update(&frameMD5, &m_data[0], m_data.size());
-    writeToFile(frameMD5);
+bool DecodeOutputCompare::fail()
+{
+    m_failed = true;
+    return false;
+}
+
+bool DecodeOutputCompare::compareDigest(const SharedPtr<VideoFrame>& frame)
+{
+    //same as render mode -2
+    if (frame->fourcc == YAMI_FOURCC_P010 && m_destFourcc != YAMI_FOURCC_P010) {
+        m_destFourcc = YAMI_FOURCC_P010;
+        m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_maxWidth, m_maxHeight));
+    }
+    if (m_frames >= m_digests.size()) {
+        fprintf(stderr, "frame %u: reference has only %u frames\n", m_frames, (uint32_t)m_digests.size());
+        return fail();
+    }
+    m_digest->reset();
+    DigestSink sink(*m_digest);
+    if (!m_convert->convert(sink, frame))
+        return fail();
+    std::string result = m_digest->final();
+    if (strcasecmp(result.c_str(), m_digests[m_frames].c_str())) {
+        fprintf(stderr, "frame %u: %s mismatch, expect %s, got %s\n", m_frames, m_digest->name(),
+            m_digests[m_frames].c_str(), result.c_str());
+        return fail();
+    }
+    return true;
+}
 
-    MD5Update(&m_fileMD5, &m_data[0], m_data.size());
+bool DecodeOutputCompare::compareFrame(const SharedPtr<VideoFrame>& frame)
+{
+    if (m_y4m && ((int)frame->crop.width != m_y4mWidth || (int)frame->crop.height != m_y4mHeight)) {
+        fprintf(stderr, "frame %u: size is %dx%d, reference is %dx%d\n", m_frames, frame->crop.width,
+            frame->crop.height, m_y4mWidth, m_y4mHeight);
+        return fail();
+    }
+    MappedFrame mapped;
+    if (!m_convert->map(mapped, frame))
+        return fail();
+    size_t size = 0;
+    for (uint32_t i = 0; i < mapped.planes; i++)
+        size += mapped.width[i] * mapped.height[i];
+    m_reference.resize(size);
+    if ((m_y4m && !Y4MHeader::readFrame(m_file)) || fread(&m_reference[0], 1, size, m_file) != size) {
+        fprintf(stderr, "frame %u: reference has only %u frames of %dx%d\n", m_frames, m_frames,
+            frame->crop.width, frame->crop.height);
+        return fail();
+    }
+    const uint8_t* ref = &m_reference[0];
+    for (uint32_t i = 0; i < mapped.planes; i++) {
+        const uint8_t* row = mapped.data[i];
+        for (uint32_t y = 0; y < mapped.height[i]; y++) {
+            if (memcmp(row, ref, mapped.width[i])) {
+                uint32_t x = 0;
+                while (row[x] == ref[x])
+                    x++;
+                fprintf(stderr, "frame %u: plane %u differs at byte (%u, %u) of %ux%u, expect %u, got %u\n",
+                    m_frames, i, x, y, mapped.width[i], mapped.height[i], ref[x], row[x]);
+                return fail();
+            }
+            row += mapped.pitch[i];
+            ref += mapped.width[i];
+        }
+    }
+    return true;
+}
 
+bool DecodeOutputCompare::output(const SharedPtr<VideoFrame>& frame)
+{
+    if (m_failed)
+        return false;
+    if (!setVideoSize(frame->crop.width, frame->crop.height))
+        return fail();
+    if (!(m_digest ? compareDigest(frame) : compareFrame(frame)))
+        return false;
+    m_frames++;
     return true;
 }
 
-#endif //__ENABLE_MD5__
+bool DecodeOutputCompare::finish(bool eos)
+{
+    if (!m_failed && eos) {
+        bool more = m_digest ? m_frames < m_digests.size() : fgetc(m_file) != EOF;
+        if (more) {
+            fprintf(stderr, "stream ended at frame %u, reference has more\n", m_frames);
+            m_failed = true;
+        }
+    }
+    if (m_failed)
+        return false;
+    fprintf(stderr, "%u frames match %s\n", m_frames, m_outputFile);
+    return true;
+}
 
 #ifdef __ENABLE_X11__
 class DecodeOutputX11 : public DecodeOutput
@@ -494,6 +942,8 @@ bool DecodeOutputX11::createX11Display()
 {
     SharedPtr<VADisplay> display;
 
+    //we render on the output thread while the decoder uses the display on its own
+    XInitThreads();
     m_display = XOpenDisplay(NULL);
     if (!m_display) {
         ERROR("Failed to XOpenDisplay for DecodeOutputX11");
@@ -909,15 +1359,28 @@ DecodeOutputWayland::~DecodeOutputWayland()
 }
 #endif
 
-DecodeOutput* DecodeOutput::create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile)
+DecodeOutput* DecodeOutput::create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile,
+    int maxWidth, int maxHeight, const char* digest, bool digestTree, uint32_t digestThreads, const char* golden)
 {
     DecodeOutput* output;
     switch (renderMode) {
-#ifdef __ENABLE_MD5__
-    case -2:
-        output = new DecodeOutputMD5(outputFile, inputFile, fourcc);
+    case -3:
+        if (!golden) {
+            fprintf(stderr, "render mode -3 needs a reference, see --golden\n");
+            return NULL;
+        }
+        output = new DecodeOutputCompare(golden, inputFile, fourcc);
         break;
-#endif //__ENABLE_MD5__
+    case -2: {
+        SharedPtr<FrameDigest> frameDigest = FrameDigest::create(digest);
+        SharedPtr<FrameDigest> fileDigest = FrameDigest::create(digest);
+        if (!frameDigest || !fileDigest) {
+            fprintf(stderr, "digest %s is not supported\n", digest ? digest : FrameDigest::defaultName());
+            return NULL;
+        }
+        output = new DecodeOutputDigest(outputFile, inputFile, fourcc, frameDigest, fileDigest, digestTree, digestThreads);
+        break;
+    }
     case -1:
         output = new DecodeOutputNull();
         break;
@@ -950,6 +1413,8 @@ DecodeOutput* DecodeOutput::create(int renderMode, uint32_t fourcc, const char*
         fprintf(stderr, "renderMode:%d, do not support this render mode\n", renderMode);
         return NULL;
     }
+    output->m_maxWidth = maxWidth;
+    output->m_maxHeight = maxHeight;
     if (!output->init())
         fprintf(stderr, "DecodeOutput init failed\n");
     return output;
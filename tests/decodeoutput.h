@@ -26,9 +26,19 @@
 class DecodeOutput
 {
 public:
-    static DecodeOutput* create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile);
+    //digest, digestTree and digestThreads are only used by render mode -2, NULL for the default digest,
+    //digestTree for a file digest over the frame digests, 0 threads to hash on the decoding thread.
+    //golden is the reference of render mode -3
+    static DecodeOutput* create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile,
+        int maxWidth = 0, int maxHeight = 0, const char* digest = NULL, bool digestTree = false,
+        uint32_t digestThreads = 0,
+        const char* golden = NULL);
     virtual bool output(const SharedPtr<VideoFrame>& frame) = 0;
+    //after the last frame, eos is false if we stopped early.
+    //return false if the frames are not what we expected
+    virtual bool finish(bool eos);
     SharedPtr<NativeDisplay> nativeDisplay();
+    DecodeOutput();
     virtual ~DecodeOutput() {}
 protected:
     virtual bool setVideoSize(uint32_t with, uint32_t height);
@@ -37,6 +47,9 @@ protected:
 
     uint32_t m_width;
     uint32_t m_height;
+    //max resolution given by user, 0 if unknown
+    int m_maxWidth;
+    int m_maxHeight;
     SharedPtr<VADisplay> m_vaDisplay;
     SharedPtr<NativeDisplay> m_nativeDisplay;
 };
@@ -28,12 +28,109 @@
 #include <X11/Xlib.h>
 #endif
 #include "common/log.h"
+#include "common/EncoderDrain.h"
+#include "common/Pipeline.h"
 #include <Yami.h>
 #include "encodeinput.h"
 #include "encodehelp.h"
 
 using namespace YamiMediaCodec;
 
+//reads raw frames and submits them, waits only while the encoder is full
+class EncodeSubmitStage : public Pipeline::Stage {
+public:
+    EncodeSubmitStage(EncodeInput* input, const SharedPtr<EncoderDrain>& drain)
+        : Pipeline::Stage("encode")
+        , m_input(input)
+        , m_drain(drain)
+    {
+    }
+
+    bool run()
+    {
+        VideoFrameRawData inputBuffer;
+        uint64_t i = 0;
+        while (!m_input->isEOS()) {
+            memset(&inputBuffer, 0, sizeof(inputBuffer));
+            if (!m_input->getOneFrameInput(inputBuffer))
+                break;
+            inputBuffer.timeStamp = i++;
+            Encode_Status status = m_drain->encode(&inputBuffer);
+            m_input->recycleOneFrameInput(inputBuffer);
+            if (status != ENCODE_SUCCESS) {
+                if (cancelled())
+                    return true;
+                fprintf(stderr, "encode failed status = %d\n", status);
+                return false;
+            }
+            addItem();
+
+            if (frameCount && items() >= (uint64_t)frameCount)
+                break;
+        }
+        //the encoder is flushed when the pipeline closes the drain
+        return true;
+    }
+
+private:
+    EncodeInput* m_input;
+    SharedPtr<EncoderDrain> m_drain;
+};
+
+//takes the bitstream out as soon as a frame is encoded and writes it
+class EncodeOutputStage : public Pipeline::Stage {
+public:
+    EncodeOutputStage(const SharedPtr<EncoderDrain>& drain, EncodeOutput* output,
+        VideoEncOutputBuffer& outputBuffer, uint32_t maxOutSize, VideoEncMVBuffer* MVBuffer)
+        : Pipeline::Stage("output")
+        , m_drain(drain)
+        , m_output(output)
+        , m_outputBuffer(outputBuffer)
+        , m_maxOutSize(maxOutSize)
+        , m_MVBuffer(MVBuffer)
+    {
+    }
+
+    bool run()
+    {
+        Encode_Status status;
+        while ((status = m_drain->getOutput(&m_outputBuffer, m_MVBuffer)) != ENCODE_BUFFER_NO_MORE) {
+            if (status == ENCODE_BUFFER_TOO_SMALL) {
+                m_maxOutSize = (m_maxOutSize * 3) / 2;
+                if (!createOutputBuffer(&m_outputBuffer, m_maxOutSize)) {
+                    fprintf(stderr, "fail to create output\n");
+                    return false;
+                }
+                continue;
+            }
+            if (status != ENCODE_SUCCESS) {
+                fprintf(stderr, "get encoded output failed status = %d\n", status);
+                return false;
+            }
+            if (m_output->write(m_outputBuffer.data, m_outputBuffer.dataSize)) {
+                DEBUG("timeStamp(PTS) : "
+                      "%" PRIu64,
+                      m_outputBuffer.timeStamp);
+                DEBUG("output data size %d", m_outputBuffer.dataSize);
+            }
+#ifdef __BUILD_GET_MV__
+            fwrite(m_MVBuffer->data, m_MVBuffer->bufferSize, 1, MVFp);
+#endif
+            addItem();
+        }
+        if (cancelled())
+            return true;
+        return m_output->flush();
+    }
+
+private:
+    SharedPtr<EncoderDrain> m_drain;
+    EncodeOutput* m_output;
+    VideoEncOutputBuffer& m_outputBuffer;
+    uint32_t m_maxOutSize;
+    VideoEncMVBuffer* m_MVBuffer;
+};
+
 int main(int argc, char** argv)
 {
     IVideoEncoder *encoder = NULL;
@@ -41,9 +138,7 @@ int main(int argc, char** argv)
     EncodeInput* input;
     EncodeOutput* output;
     Encode_Status status;
-    VideoFrameRawData inputBuffer;
     VideoEncOutputBuffer outputBuffer;
-    int encodeFrameCount = 0;
 
     memset(&outputBuffer, 0, sizeof(VideoEncOutputBuffer));
     if (!process_cmdline(argc, argv))
@@ -145,80 +240,22 @@ int main(int argc, char** argv)
         delete output;
         return -1;
     }
-    uint64_t i = 0;
-    while (!input->isEOS())
+
     {
-        memset(&inputBuffer, 0, sizeof(inputBuffer));
-        if (input->getOneFrameInput(inputBuffer)) {
-            inputBuffer.timeStamp = i++;
-            status = encoder->encode(&inputBuffer);
-            ASSERT(status == ENCODE_SUCCESS);
-            input->recycleOneFrameInput(inputBuffer);
-        }
-        else
-            break;
-
-        //get the output buffer
-        do {
-#ifndef __BUILD_GET_MV__
-            status = encoder->getOutput(&outputBuffer, false);
-#else
-            status = encoder->getOutput(&outputBuffer, &MVBuffer, false);
-#endif
-            if (status == ENCODE_SUCCESS
-                && output->write(outputBuffer.data, outputBuffer.dataSize)) {
-                DEBUG("timeStamp(PTS) : "
-                      "%" PRIu64,
-                      outputBuffer.timeStamp);
-                DEBUG("output data size %d", outputBuffer.dataSize);
-            }
+        //submit and bitstream retrieval on their own threads, so the encoder
+        //keeps several frames in flight while we write the output
+        SharedPtr<EncoderDrain> drain(new EncoderDrain(encoder));
+        VideoEncMVBuffer* mv = NULL;
 #ifdef __BUILD_GET_MV__
-            if (status == ENCODE_SUCCESS) {
-                fwrite(MVBuffer.data, MVBuffer.bufferSize, 1, MVFp);
-            }
+        mv = &MVBuffer;
 #endif
-            if (status == ENCODE_BUFFER_TOO_SMALL) {
-                maxOutSize = (maxOutSize * 3) / 2;
-                if (!createOutputBuffer(&outputBuffer, maxOutSize)) {
-                    fprintf(stderr, "fail to create output\n");
-                    goto error1;
-                }
-            }
-        } while (status != ENCODE_BUFFER_NO_MORE);
-
-        encodeFrameCount++;
-
-        if (frameCount && encodeFrameCount >= frameCount)
-            break;
+        Pipeline pipeline;
+        pipeline.addQueue(drain);
+        pipeline.add(SharedPtr<Pipeline::Stage>(new EncodeSubmitStage(input, drain)), drain);
+        pipeline.add(SharedPtr<Pipeline::Stage>(new EncodeOutputStage(drain, output, outputBuffer, maxOutSize, mv)));
+        pipeline.run();
     }
 
-    // drain the output buffer
-    encoder->flush();
-    do {
-#ifndef __BUILD_GET_MV__
-       status = encoder->getOutput(&outputBuffer, true);
-#else
-       status = encoder->getOutput(&outputBuffer, &MVBuffer, true);
-#endif
-       if (status == ENCODE_SUCCESS
-           && output->write(outputBuffer.data, outputBuffer.dataSize)) {
-           DEBUG("timeStamp(PTS) : " "%" PRIu64 "\n", outputBuffer.timeStamp);
-       }
-#ifdef __BUILD_GET_MV__
-        if (status == ENCODE_SUCCESS) {
-            fwrite(MVBuffer.data, MVBuffer.bufferSize, 1, MVFp);
-        }
-#endif
-        if (status == ENCODE_BUFFER_TOO_SMALL) {
-            maxOutSize = (maxOutSize * 3) / 2;
-            if (!createOutputBuffer(&outputBuffer, maxOutSize)) {
-                fprintf(stderr, "fail to create output\n");
-                goto error1;
-            }
-        }
-    } while (status != ENCODE_BUFFER_NO_MORE);
-
-error1:
     encoder->stop();
     releaseVideoEncoder(encoder);
     free(outputBuffer.data);
@@ -32,6 +32,8 @@ EncodeInputDecoder::EncodeInputDecoder(DecodeInput* input)
 }
 EncodeInputDecoder::~EncodeInputDecoder()
 {
+    //unmap before the decoder terminates the display
+    m_images.clear();
     if (m_decoder) {
         m_decoder->stop();
         releaseVideoDecoder(m_decoder);
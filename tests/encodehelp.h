@@ -17,6 +17,8 @@
 #ifndef __ENCODE_HELP__
 #define __ENCODE_HELP__
 #include <getopt.h>
+#include "common/CpuAffinity.h"
+#include "common/WriteBehindFile.h"
 #include <Yami.h>
 
 static int referenceMode = 0;
@@ -40,6 +42,8 @@ static uint32_t initBufferFullness = 0;
 static uint32_t windowSize = 1000;
 static uint32_t targetPercentage = 95;
 static uint32_t qualityLevel = VIDEO_PARAMS_QUALITYLEVEL_NONE;
+//--affinity, applied once all options are parsed
+static char *cpuAffinity = NULL;
 
 #ifdef __BUILD_GET_MV__
 static FILE *MVFp;
@@ -62,7 +66,7 @@ static FILE *MVFp;
 static void print_help(const char* app)
 {
     printf("%s <options>\n", app);
-    printf("   -i <source yuv filename> load YUV from a file\n");
+    printf("   -i <source yuv filename> load YUV from a file, y4m carries its own size\n");
     printf("   -W <width> -H <height>\n");
     printf("   -o <coded file> optional\n");
     printf("   -b <bitrate: kbps> optional\n");
@@ -86,6 +90,9 @@ static void print_help(const char* app)
     printf("   --vbv-buffer-size <vbv buffer size in bit> optional\n");
     printf("   --quality-level <encoded video qulity level(default 0), range[%d, %d]> optional\n",
         VIDEO_PARAMS_QUALITYLEVEL_NONE, VIDEO_PARAMS_QUALITYLEVEL_MAX);
+    printf("   --affinity <node:N | cpu list like 0-3,8, pin threads there and allocate host buffers on that numa node> optional\n");
+    printf("   --write-behind <number of 4M buffers queued for a writer thread, 0: write in place (default)> optional\n");
+    printf("   --direct-io <bypass page cache for write-behind output> optional\n");
 }
 
 static VideoRateControl string_to_rc_mode(char *str)
@@ -123,6 +130,9 @@ static bool process_cmdline(int argc, char *argv[])
         { "vbv-buffer-fullness", required_argument, NULL, 0 },
         { "vbv-buffer-size", required_argument, NULL, 0 },
         { "quality-level", required_argument, NULL, 0 },
+        { "affinity", required_argument, NULL, 0 },
+        { "write-behind", required_argument, NULL, 0 },
+        { "direct-io", no_argument, NULL, 0 },
         { NULL, no_argument, NULL, 0 }
     };
     int option_index;
@@ -208,6 +218,15 @@ static bool process_cmdline(int argc, char *argv[])
                 case 13:
                     qualityLevel = atoi(optarg);
                     break;
+                case 14:
+                    cpuAffinity = optarg;
+                    break;
+                case 15:
+                    WriteBehindFile::setQueueDepth(atoi(optarg));
+                    break;
+                case 16:
+                    WriteBehindFile::setDirectIO(true);
+                    break;
             }
         }
     }
@@ -227,6 +246,13 @@ static bool process_cmdline(int argc, char *argv[])
     if (inputFileName && !strncmp(inputFileName, "/dev/video", strlen("/dev/video")) && !frameCount)
         frameCount = 50;
 
+    //before any thread starts, they all inherit it
+    if (cpuAffinity) {
+        CpuAffinity affinity;
+        if (!affinity.parse(cpuAffinity) || !affinity.apply())
+            return false;
+    }
+
     return true;
 }
 
@@ -23,8 +23,13 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "common/log.h"
 #include "common/utils.h"
+#include "common/WriteBehindFile.h"
+#include "common/Y4MHeader.h"
 
 #include "encodeinput.h"
 #include "encodeInputDecoder.h"
@@ -74,11 +79,36 @@ EncodeInputFile::EncodeInputFile()
     : m_fp(NULL)
     , m_buffer(NULL)
     , m_readToEOS(false)
+    , m_y4m(false)
+    , m_map(NULL)
+    , m_mapSize(0)
+    , m_pos(0)
+    , m_released(0)
+    , m_advised(0)
 {
 }
 
 bool EncodeInputFile::init(const char* inputFileName, uint32_t fourcc, int width, int height)
 {
+    m_fp = fopen(inputFileName, "r");
+    if (!m_fp) {
+        fprintf(stderr, "fail to open input file: %s", inputFileName);
+        return false;
+    }
+
+    //y4m carries its own format
+    Y4MHeader y4m;
+    if (y4m.read(m_fp)) {
+        if (y4m.fourcc != YAMI_FOURCC_I420) {
+            fprintf(stderr, "only 4:2:0 y4m input is supported\n");
+            return false;
+        }
+        m_y4m = true;
+        fourcc = y4m.fourcc;
+        width = y4m.width;
+        height = y4m.height;
+    }
+
     if (!width || !height) {
         if (!guessResolution(inputFileName, width, height)) {
             fprintf(stderr, "failed to guess input width and height\n");
@@ -117,13 +147,96 @@ bool EncodeInputFile::init(const char* inputFileName, uint32_t fourcc, int width
     break;
     }
 
-    m_fp = fopen(inputFileName, "r");
-    if (!m_fp) {
-        fprintf(stderr, "fail to open input file: %s", inputFileName);
+    if (!mapFile())
+        m_buffer = static_cast<uint8_t*>(malloc(m_frameSize));
+    return true;
+}
+
+bool EncodeInputFile::mapFile()
+{
+    struct stat st;
+    int fd = fileno(m_fp);
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size)
+        return false;
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+    m_map = static_cast<uint8_t*>(p);
+    m_mapSize = st.st_size;
+    //past the y4m header
+    m_pos = ftell(m_fp);
+    madvise(m_map, m_mapSize, MADV_SEQUENTIAL);
+    readAhead();
+    return true;
+}
+
+bool EncodeInputFile::skipFrameHeader()
+{
+    if (m_pos >= m_mapSize)
+        return false;
+    uint8_t* p = m_map + m_pos;
+    size_t left = m_mapSize - m_pos;
+    uint8_t* end = static_cast<uint8_t*>(memchr(p, '\n', left));
+    if (left < 5 || memcmp(p, "FRAME", 5) || !end) {
+        fprintf(stderr, "y4m frame header is missing\n");
         return false;
     }
+    m_pos += end - p + 1;
+    return true;
+}
 
-    m_buffer = static_cast<uint8_t*>(malloc(m_frameSize));
+void EncodeInputFile::readAhead()
+{
+    size_t end = std::min(m_mapSize, m_pos + READ_AHEAD_FRAMES * m_frameSize);
+    if (end <= m_advised)
+        return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = std::max(m_advised, m_pos) / page * page;
+    madvise(m_map + start, end - start, MADV_WILLNEED);
+    m_advised = end;
+}
+
+bool EncodeInputFile::getMappedFrame(VideoFrameRawData &inputBuffer)
+{
+    if (m_y4m && !skipFrameHeader()) {
+        m_readToEOS = true;
+        return false;
+    }
+    if (m_pos >= m_mapSize) {
+        m_readToEOS = true;
+        return false;
+    }
+    size_t left = m_mapSize - m_pos;
+    if (left < m_frameSize) {
+        fprintf (stderr, "data is not enough to read(read size: %zu, m_frameSize: %zu), maybe resolution is wrong\n", left, m_frameSize);
+        m_readToEOS = true;
+        return false;
+    }
+    uint8_t* frame = m_map + m_pos;
+    m_pos += m_frameSize;
+    readAhead();
+
+    //the caller wants the frame in its own buffer
+    if (inputBuffer.handle) {
+        uint8_t* buffer = reinterpret_cast<uint8_t*>(inputBuffer.handle);
+        memcpy(buffer, frame, m_frameSize);
+        frame = buffer;
+    }
+    return fillFrameRawData(&inputBuffer, m_fourcc, m_width, m_height, frame);
+}
+
+bool EncodeInputFile::recycleOneFrameInput(VideoFrameRawData &inputBuffer)
+{
+    uint8_t* frame = reinterpret_cast<uint8_t*>(inputBuffer.handle);
+    if (!m_map || frame < m_map || frame >= m_map + m_mapSize)
+        return true;
+    //the encoder is done with it, drop our pages up to the frame end, page cache keeps them
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end = (frame - m_map + m_frameSize) / page * page;
+    if (end > m_released) {
+        madvise(m_map + m_released, end - m_released, MADV_DONTNEED);
+        m_released = end;
+    }
     return true;
 }
 
@@ -131,11 +244,18 @@ bool EncodeInputFile::getOneFrameInput(VideoFrameRawData &inputBuffer)
 {
     if (m_readToEOS)
         return false;
+    if (m_map)
+        return getMappedFrame(inputBuffer);
 
     uint8_t *buffer = m_buffer;
     if (inputBuffer.handle)
         buffer = reinterpret_cast<uint8_t*>(inputBuffer.handle);
 
+    if (m_y4m && !Y4MHeader::readFrame(m_fp)) {
+        m_readToEOS = true;
+        return false;
+    }
+
     size_t ret = fread(buffer, sizeof(uint8_t), m_frameSize, m_fp);
 
     if (ret <= 0) {
@@ -153,6 +273,8 @@ bool EncodeInputFile::getOneFrameInput(VideoFrameRawData &inputBuffer)
 
 EncodeInputFile::~EncodeInputFile()
 {
+    if (m_map)
+        munmap(m_map, m_mapSize);
     if(m_fp)
         fclose(m_fp);
 
@@ -221,7 +343,7 @@ EncodeOutput* EncodeOutput::create(const char* outputFileName, int width,
 
 bool EncodeOutput::init(const char* outputFileName, int width, int height, int fps)
 {
-    m_fp = fopen(outputFileName, "w+");
+    m_fp = WriteBehindFile::open(outputFileName, "w+");
     if (!m_fp) {
         fprintf(stderr, "fail to open output file: %s\n", outputFileName);
         return false;
@@ -234,6 +356,11 @@ bool EncodeOutput::write(void* data, int size)
     return fwrite(data, 1, size, m_fp) == (size_t)size;
 }
 
+bool EncodeOutput::flush()
+{
+    return WriteBehindFile::flush(m_fp);
+}
+
 const char* EncodeOutputH264::getMimeType()
 {
     return YAMI_MIME_H264;
@@ -63,13 +63,31 @@ public:
     ~EncodeInputFile();
     virtual bool init(const char* inputFileName, uint32_t fourcc, int width, int height);
     virtual bool getOneFrameInput(VideoFrameRawData &inputBuffer);
+    virtual bool recycleOneFrameInput(VideoFrameRawData &inputBuffer);
     virtual bool isEOS() {return m_readToEOS;}
 
 protected:
     FILE *m_fp;
     uint8_t *m_buffer;
     bool m_readToEOS;
+    //every frame starts with a FRAME line
+    bool m_y4m;
 private:
+    bool mapFile();
+    bool getMappedFrame(VideoFrameRawData &inputBuffer);
+    bool skipFrameHeader();
+    void readAhead();
+
+    //regular files are mapped, frames are handed to the encoder in place
+    uint8_t *m_map;
+    size_t m_mapSize;
+    //offset of the next frame
+    size_t m_pos;
+    //pages before m_released are dropped, before m_advised are asked for
+    size_t m_released;
+    size_t m_advised;
+    //frames we ask the kernel to read ahead of the encoder
+    static const size_t READ_AHEAD_FRAMES = 4;
     DISALLOW_COPY_AND_ASSIGN(EncodeInputFile);
 };
 
@@ -137,6 +155,8 @@ public:
     static EncodeOutput* create(const char* outputFileName, int width,
         int height, int fps = 30, const char* codecName = NULL);
     virtual bool write(void* data, int size);
+    //wait until all data written reach the file
+    bool flush();
     virtual const char* getMimeType() = 0;
 protected:
     virtual bool init(const char* outputFileName, int width, int height, int fps = 30);
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pipelinestages.h"
+#include "common/log.h"
+
+SharedPtr<FrameTrace> createFrameTrace()
+{
+    static const char* names[] = { "read", "decoded", "vpp", "submit", "bitstream", "output" };
+    std::vector<std::string> points(names, names + N_ELEMENTS(names));
+    return SharedPtr<FrameTrace>(new FrameTrace(points));
+}
+
+InputStage::InputStage(const SharedPtr<VppInput>& input, const SharedPtr<FrameQueue>& output, uint32_t maxFrames)
+    : TracedStage("input")
+    , m_input(input)
+    , m_outputs(1, output)
+    , m_maxFrames(maxFrames)
+    , m_eos(false)
+{
+}
+
+InputStage::InputStage(const SharedPtr<VppInput>& input, const FrameQueues& outputs, uint32_t maxFrames)
+    : TracedStage("input")
+    , m_input(input)
+    , m_outputs(outputs)
+    , m_maxFrames(maxFrames)
+    , m_eos(false)
+{
+}
+
+bool InputStage::run()
+{
+    uint32_t count = 0;
+    while (count < m_maxFrames) {
+        SharedPtr<VideoFrame> frame;
+        stamp(count, TRACE_READ);
+        if (!m_input->read(frame)) {
+            m_eos = true;
+            break;
+        }
+        if (tracing()) {
+            save(count, frame->timeStamp);
+            stamp(count, TRACE_DECODED);
+        }
+        for (size_t i = 0; i < m_outputs.size(); i++) {
+            if (!push(*m_outputs[i], frame))
+                return true;
+        }
+        addItem();
+        count++;
+    }
+    return true;
+}
+
+VppStage::VppStage(const SharedPtr<IVideoPostProcess>& vpp, const SharedPtr<FrameAllocator>& allocator,
+    const SharedPtr<FrameQueue>& input, const SharedPtr<FrameQueue>& output)
+    : TracedStage("vpp")
+    , m_vpp(vpp)
+    , m_allocator(allocator)
+    , m_input(input)
+    , m_output(output)
+{
+}
+
+bool VppStage::run()
+{
+    SharedPtr<VideoFrame> src;
+    while (pop(*m_input, src)) {
+        SharedPtr<VideoFrame> dest = m_allocator->alloc();
+        if (!dest) {
+            ERROR("failed to get output frame");
+            return false;
+        }
+        YamiStatus status = m_vpp->process(src, dest);
+        if (status != YAMI_SUCCESS) {
+            ERROR("vpp process failed, status = %d", status);
+            return false;
+        }
+        dest->timeStamp = src->timeStamp;
+        stamp(dest->timeStamp, TRACE_VPP);
+        //give the source back to its pool before we block on the queue
+        src.reset();
+        if (!push(*m_output, dest))
+            break;
+        addItem();
+    }
+    return true;
+}
+
+OutputStage::OutputStage(const SharedPtr<VppOutput>& output, const SharedPtr<FrameQueue>& input, bool logFps)
+    : TracedStage("output")
+    , m_output(output)
+    , m_input(input)
+    , m_logFps(logFps)
+{
+}
+
+bool OutputStage::run()
+{
+    FpsCalc fps;
+    SharedPtr<VideoFrame> frame;
+    while (pop(*m_input, frame)) {
+        int64_t id = tracing() ? restore(frame->timeStamp) : frame->timeStamp;
+        if (!m_output->output(frame))
+            return false;
+        stamp(id, TRACE_OUTPUT);
+        addItem();
+        fps.addFrame();
+    }
+    if (cancelled())
+        return true;
+    //flush output
+    frame.reset();
+    bool ret = m_output->output(frame);
+    if (m_logFps)
+        fps.log();
+    return ret;
+}
+
+EncodeStage::EncodeStage(const SharedPtr<VppOutputEncode>& encode, const SharedPtr<FrameQueue>& input, bool logFps)
+    : TracedStage("encode")
+    , m_encode(encode)
+    , m_input(input)
+    , m_logFps(logFps)
+{
+}
+
+bool EncodeStage::run()
+{
+    FpsCalc fps;
+    SharedPtr<VideoFrame> frame;
+    while (pop(*m_input, frame)) {
+        //the bitstream may be out before encode() returns
+        stamp(frame->timeStamp, TRACE_SUBMIT);
+        if (!m_encode->encode(frame))
+            return cancelled();
+        frame.reset();
+        addItem();
+        fps.addFrame();
+    }
+    //the encoder is flushed when the pipeline closes its drain
+    if (m_logFps && !cancelled())
+        fps.log();
+    return true;
+}
+
+BitstreamStage::BitstreamStage(const SharedPtr<VppOutputEncode>& encode, const SharedPtr<CodedQueue>& output)
+    : TracedStage("bitstream")
+    , m_encode(encode)
+    , m_output(output)
+{
+}
+
+bool BitstreamStage::run()
+{
+    SharedPtr<CodedBuffer> coded;
+    while (m_encode->getCoded(coded)) {
+        //the last one
+        if (!coded)
+            return true;
+        stamp(coded->timeStamp, TRACE_BITSTREAM);
+        if (!push(*m_output, coded))
+            return true;
+        addItem();
+    }
+    return cancelled();
+}
+
+CodedWriteStage::CodedWriteStage(const SharedPtr<VppOutputEncode>& encode, const SharedPtr<CodedQueue>& input)
+    : TracedStage("write")
+    , m_encode(encode)
+    , m_input(input)
+{
+}
+
+bool CodedWriteStage::run()
+{
+    SharedPtr<CodedBuffer> coded;
+    while (pop(*m_input, coded)) {
+        int64_t id = tracing() ? restore(coded->timeStamp) : coded->timeStamp;
+        if (!m_encode->write(coded))
+            return false;
+        stamp(id, TRACE_OUTPUT);
+        addItem();
+    }
+    if (cancelled())
+        return true;
+    coded.reset();
+    return m_encode->write(coded);
+}
+
+static void addStage(Pipeline& pipeline, const SharedPtr<TracedStage>& stage,
+    const SharedPtr<FrameTrace>& trace, const SharedPtr<Pipeline::QueueBase>& output = SharedPtr<Pipeline::QueueBase>())
+{
+    if (trace)
+        stage->addTrace(trace);
+    pipeline.add(stage, output);
+}
+
+void addOutputStages(Pipeline& pipeline, const SharedPtr<VppOutput>& output,
+    const SharedPtr<FrameQueue>& input, bool logFps, const SharedPtr<FrameTrace>& trace)
+{
+    SharedPtr<VppOutputEncode> encode = DynamicPointerCast<VppOutputEncode>(output);
+    if (!encode) {
+        addStage(pipeline, SharedPtr<TracedStage>(new OutputStage(output, input, logFps)), trace);
+        return;
+    }
+    SharedPtr<CodedQueue> coded = pipeline.createQueue<SharedPtr<CodedBuffer> >(CODED_QUEUE_DEPTH);
+    SharedPtr<EncoderDrain> drain = encode->drain();
+    pipeline.addQueue(drain);
+    addStage(pipeline, SharedPtr<TracedStage>(new EncodeStage(encode, input, logFps)), trace, drain);
+    addStage(pipeline, SharedPtr<TracedStage>(new BitstreamStage(encode, coded)), trace, coded);
+    addStage(pipeline, SharedPtr<TracedStage>(new CodedWriteStage(encode, coded)), trace);
+}
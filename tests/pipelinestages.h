@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef pipelinestages_h
+#define pipelinestages_h
+
+#include "common/FrameTrace.h"
+#include "common/Pipeline.h"
+#include "vppinputoutput.h"
+#include "vppoutputencode.h"
+#include <limits.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+typedef Pipeline::Queue<SharedPtr<VideoFrame> > FrameQueue;
+typedef Pipeline::Queue<SharedPtr<CodedBuffer> > CodedQueue;
+
+//frames queued between two stages, pools feeding a queue need this many more frames
+const uint32_t FRAME_QUEUE_DEPTH = 2;
+const uint32_t CODED_QUEUE_DEPTH = 16;
+
+typedef std::vector<SharedPtr<FrameQueue> > FrameQueues;
+
+//points the stages below stamp on a FrameTrace. traced frames carry their trace id
+//in timeStamp from the input stage on, the stages handing frames and bitstreams
+//out of the pipeline give them their own timeStamp back
+enum TracePoint {
+    TRACE_READ,
+    TRACE_DECODED,
+    TRACE_VPP,
+    TRACE_SUBMIT,
+    TRACE_BITSTREAM,
+    TRACE_OUTPUT
+};
+
+//a trace with the points above
+SharedPtr<FrameTrace> createFrameTrace();
+
+//a stage stamping the frames it passes
+class TracedStage : public Pipeline::Stage {
+public:
+    explicit TracedStage(const char* name)
+        : Pipeline::Stage(name)
+    {
+    }
+    //each branch after a fan-out has its own trace, the stage before stamps all of them
+    void addTrace(const SharedPtr<FrameTrace>& trace) { m_traces.push_back(trace); }
+
+protected:
+    bool tracing() const { return !m_traces.empty(); }
+    void stamp(int64_t id, TracePoint point)
+    {
+        for (size_t i = 0; i < m_traces.size(); i++)
+            m_traces[i]->stamp(id, point);
+    }
+    //frame started at the first point, it carries id from now on
+    void save(int64_t id, int64_t& timeStamp)
+    {
+        for (size_t i = 0; i < m_traces.size(); i++)
+            m_traces[i]->save(id, timeStamp);
+        timeStamp = id;
+    }
+    //the frame is leaving the pipeline, returns the id it carried
+    int64_t restore(int64_t& timeStamp)
+    {
+        int64_t id = timeStamp;
+        if (!m_traces.empty() && !m_traces[0]->restore(id, timeStamp))
+            ERROR("timeStamp of frame %lld is lost, more frames in flight than the trace holds", (long long)id);
+        return id;
+    }
+
+private:
+    std::vector<SharedPtr<FrameTrace> > m_traces;
+};
+
+//reads frames from a VppInput, a decoder or a raw file.
+//when traced, frames carry their sequence number as timeStamp, see TracePoint
+class InputStage : public TracedStage {
+public:
+    InputStage(const SharedPtr<VppInput>& input, const SharedPtr<FrameQueue>& output,
+        uint32_t maxFrames = UINT_MAX);
+    //every output gets every frame, the frame goes back to its pool when all are done with it
+    InputStage(const SharedPtr<VppInput>& input, const FrameQueues& outputs,
+        uint32_t maxFrames = UINT_MAX);
+    bool run();
+    //the input ran out, we did not stop at maxFrames or because another stage failed
+    bool eos() const { return m_eos; }
+
+private:
+    SharedPtr<VppInput> m_input;
+    FrameQueues m_outputs;
+    uint32_t m_maxFrames;
+    bool m_eos;
+};
+
+//processes every frame into a new frame from allocator
+class VppStage : public TracedStage {
+public:
+    VppStage(const SharedPtr<IVideoPostProcess>& vpp, const SharedPtr<FrameAllocator>& allocator,
+        const SharedPtr<FrameQueue>& input, const SharedPtr<FrameQueue>& output);
+    bool run();
+
+private:
+    SharedPtr<IVideoPostProcess> m_vpp;
+    SharedPtr<FrameAllocator> m_allocator;
+    SharedPtr<FrameQueue> m_input;
+    SharedPtr<FrameQueue> m_output;
+};
+
+//hands frames to a VppOutput, and flushes it at eos
+class OutputStage : public TracedStage {
+public:
+    OutputStage(const SharedPtr<VppOutput>& output, const SharedPtr<FrameQueue>& input, bool logFps);
+    bool run();
+
+private:
+    SharedPtr<VppOutput> m_output;
+    SharedPtr<FrameQueue> m_input;
+    bool m_logFps;
+};
+
+//submits frames to the encoder, a BitstreamStage takes the output
+class EncodeStage : public TracedStage {
+public:
+    EncodeStage(const SharedPtr<VppOutputEncode>& encode, const SharedPtr<FrameQueue>& input, bool logFps);
+    bool run();
+
+private:
+    SharedPtr<VppOutputEncode> m_encode;
+    SharedPtr<FrameQueue> m_input;
+    bool m_logFps;
+};
+
+//waits for encoded frames and hands the bitstream to a CodedWriteStage
+class BitstreamStage : public TracedStage {
+public:
+    BitstreamStage(const SharedPtr<VppOutputEncode>& encode, const SharedPtr<CodedQueue>& output);
+    bool run();
+
+private:
+    SharedPtr<VppOutputEncode> m_encode;
+    SharedPtr<CodedQueue> m_output;
+};
+
+class CodedWriteStage : public TracedStage {
+public:
+    CodedWriteStage(const SharedPtr<VppOutputEncode>& encode, const SharedPtr<CodedQueue>& input);
+    bool run();
+
+private:
+    SharedPtr<VppOutputEncode> m_encode;
+    SharedPtr<CodedQueue> m_input;
+};
+
+//encode, bitstream and write stages for an encoding output, an output stage for the others.
+//they stamp trace if there is one
+void addOutputStages(Pipeline& pipeline, const SharedPtr<VppOutput>& output,
+    const SharedPtr<FrameQueue>& input, bool logFps,
+    const SharedPtr<FrameTrace>& trace = SharedPtr<FrameTrace>());
+
+#endif //pipelinestages_h
@@ -20,7 +20,10 @@
 #include "vppinputoutput.h"
 #include "vppoutputencode.h"
 #include "encodeinput.h"
+#include "pipelinestages.h"
 #include "common/log.h"
+#include "common/PoolStats.h"
+#include "common/WriteBehindFile.h"
 #include <Yami.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,7 +44,8 @@ SharedPtr<VppInput> createInput(const char* filename, const SharedPtr<VADisplay>
     SharedPtr<VppInputFile> inputFile = DynamicPointerCast<VppInputFile>(input);
     if (inputFile) {
         SharedPtr<FrameReader> reader(new VaapiFrameReader(display));
-        SharedPtr<FrameAllocator> alloctor(new PooledFrameAllocator(display, 5));
+        SharedPtr<FrameAllocator> alloctor(new MappedFrameAllocator(display, 5));
+        alloctor = instrumentAllocator("input", alloctor, 5);
         inputFile->config(alloctor, reader);
     }
     return inputFile;
@@ -74,11 +78,54 @@ SharedPtr<VppOutput> createOutput(const char* filename, const SharedPtr<VADispla
     return output;
 }
 
+//raw or y4m files in host memory, no va display
+SharedPtr<VppInput> createSystemMemoryInput(const char* filename)
+{
+    SharedPtr<VppInputFile> input(new VppInputFile);
+    if (!input->init(filename, 0, 0, 0)) {
+        ERROR("%s is not a raw or y4m file", filename);
+        return SharedPtr<VppInput>();
+    }
+    SharedPtr<FrameReader> reader(new SystemMemoryFrameReader);
+    SharedPtr<FrameAllocator> allocator(new SystemMemoryFrameAllocator(5));
+    allocator = instrumentAllocator("input", allocator, 5);
+    if (!input->config(allocator, reader))
+        return SharedPtr<VppInput>();
+    return input;
+}
+
+//converts on the cpu if the formats differ, the size must not change
+SharedPtr<VppOutput> createSystemMemoryOutput(const char* filename, const SharedPtr<VppInput>& input)
+{
+    SharedPtr<VppOutput> output = VppOutput::create(filename);
+    SharedPtr<VppOutputFile> outputFile = DynamicPointerCast<VppOutputFile>(output);
+    if (!outputFile) {
+        ERROR("--sysmem writes raw or y4m files only");
+        return SharedPtr<VppOutput>();
+    }
+    uint32_t fourcc;
+    int width, height;
+    outputFile->getFormat(fourcc, width, height);
+    if (width != input->getWidth() || height != input->getHeight()) {
+        ERROR("--sysmem can't scale %dx%d to %dx%d", input->getWidth(), input->getHeight(), width, height);
+        return SharedPtr<VppOutput>();
+    }
+    if (fourcc != input->getFourcc() && !CpuColorConvert::isSupported(input->getFourcc(), fourcc)) {
+        uint32_t from = input->getFourcc();
+        ERROR("--sysmem can't convert %.4s to %.4s", (char*)&from, (char*)&fourcc);
+        return SharedPtr<VppOutput>();
+    }
+    SharedPtr<FrameWriter> writer(new SystemMemoryConvertFrameWriter(fourcc, CpuColorConvert::defaultThreads()));
+    outputFile->config(writer);
+    return output;
+}
+
 SharedPtr<FrameAllocator> createAllocator(const SharedPtr<VppOutput>& output, const SharedPtr<VADisplay>& display)
 {
     uint32_t fourcc;
     int width, height;
-    SharedPtr<FrameAllocator> allocator(new PooledFrameAllocator(display, 5));
+    SharedPtr<FrameAllocator> allocator(new MappedFrameAllocator(display, 5));
+    allocator = instrumentAllocator("vpp-output", allocator, 5);
     if (!output->getFormat(fourcc, width, height)
         || !allocator->setFormat(fourcc, width,height)) {
         allocator.reset();
@@ -91,8 +138,9 @@ class VppTest
 {
 public:
     VppTest()
+        : m_sysmem(false)
 #if YAMI_CHECK_API_VERSION(0, 2, 1)
-        : m_sharpening(SHARPENING_LEVEL_NONE)
+        , m_sharpening(SHARPENING_LEVEL_NONE)
         , m_denoise(DENOISE_LEVEL_NONE)
         , m_deinterlaceMode(NULL)
         , m_hue(COLORBALANCE_LEVEL_NONE)
@@ -106,6 +154,12 @@ public:
     {
         if (!processCmdLine(argc, argv))
             return false;
+        if (m_sysmem) {
+            m_input = createSystemMemoryInput(m_inputName);
+            if (m_input)
+                m_output = createSystemMemoryOutput(m_outputName, m_input);
+            return m_input && m_output;
+        }
         m_display = createVADisplay();
         if (!m_display) {
             printf("create display failed");
@@ -125,28 +179,33 @@ public:
         return bool(m_allocator);
     }
 
+    //input, vpp and output run on their own threads
     bool run()
     {
-
-        SharedPtr<VideoFrame> src, dest;
-        YamiStatus  status;
-        int count = 0;
-        while (m_input->read(src)) {
-            dest = m_allocator->alloc();
-            status = m_vpp->process(src, dest);
-            if (status != YAMI_SUCCESS) {
-                ERROR("vpp process failed, status = %d", status);
-                return true;
-            }
-            m_output->output(dest);
-            count++;
+        Pipeline pipeline;
+        SharedPtr<FrameQueue> input = pipeline.createQueue<SharedPtr<VideoFrame> >(FRAME_QUEUE_DEPTH);
+        SharedPtr<InputStage> inputStage(new InputStage(m_input, input));
+        SharedPtr<FrameTrace> trace = createFrameTrace();
+        inputStage->addTrace(trace);
+        pipeline.add(inputStage, input);
+        //host memory frames go to the output as they are read, it converts them
+        if (m_sysmem) {
+            addOutputStages(pipeline, m_output, input, false, trace);
+            bool ret = pipeline.run();
+            trace->report("pipeline");
+            printf("%d frame processed\n", (int)inputStage->items());
+            return ret;
         }
-        //flush output
-        dest.reset();
-        m_output->output(dest);
+        SharedPtr<FrameQueue> processed = pipeline.createQueue<SharedPtr<VideoFrame> >(FRAME_QUEUE_DEPTH);
+        SharedPtr<VppStage> vppStage(new VppStage(m_vpp, m_allocator, input, processed));
+        vppStage->addTrace(trace);
+        pipeline.add(vppStage, processed);
+        addOutputStages(pipeline, m_output, processed, false, trace);
+        bool ret = pipeline.run();
+        trace->report("pipeline");
 
-        printf("%d frame processed\n", count);
-        return true;
+        printf("%d frame processed\n", (int)vppStage->items());
+        return ret;
     }
 private:
     bool processCmdLine(int argc, char* argv[])
@@ -161,6 +220,10 @@ private:
             { "sat", required_argument, NULL, 0 },
             { "br", required_argument, NULL, 0 },
             { "con", required_argument, NULL, 0 },
+            { "pool-stats", required_argument, NULL, 0 },
+            { "write-behind", required_argument, NULL, 0 },
+            { "direct-io", no_argument, NULL, 0 },
+            { "sysmem", no_argument, NULL, 0 },
             { NULL, no_argument, NULL, 0 }
         };
         int option_index;
@@ -199,6 +262,19 @@ private:
                 case 7:
                     m_contrast = atoi(optarg);
                     break;
+                case 8:
+                    if (!PoolStatsRegistry::instance().setOutput(optarg))
+                        return false;
+                    break;
+                case 9:
+                    WriteBehindFile::setQueueDepth(atoi(optarg));
+                    break;
+                case 10:
+                    WriteBehindFile::setDirectIO(true);
+                    break;
+                case 11:
+                    m_sysmem = true;
+                    break;
                 default:
                     usage();
                     return false;
@@ -304,6 +380,7 @@ private:
     SharedPtr<VppOutput> m_output;
     SharedPtr<FrameAllocator> m_allocator;
     SharedPtr<IVideoPostProcess> m_vpp;
+    bool m_sysmem;
     int32_t m_sharpening;
     int32_t m_denoise;
     char* m_deinterlaceMode;
@@ -320,6 +397,7 @@ void usage()
     printf("a tool to do video post process, support scaling and CSC\n");
     printf("we can guess size and color format from your file name\n");
     printf("current supported format are i420, yv12, nv12\n");
+    printf("y4m files carry their own size and color format, y4m output is written as i420\n");
     printf("usage: yamivpp <option> input_1920x1080.i420 output_320x240.yv12\n");
     printf("       -s <level> optional, sharpening level\n");
     printf("       --dn <level> optional, denoise level\n");
@@ -328,6 +406,11 @@ void usage()
     printf("       --sat <level>, optional, saturation level, range [0, 100] or -1, -1: delete this filter\n");
     printf("       --br <level>, optional, brightness level, range [0, 100] or -1, -1: delete this filter\n");
     printf("       --con <level>, optional, constrast level, range [0, 100] or -1, -1: delete this filter\n");
+    printf("       --pool-stats <file>, optional, dump frame pool usage as json at exit and on SIGUSR1, - for stderr\n");
+    printf("       --write-behind <n>, optional, queue n 4M buffers for a writer thread, default 0, write in place\n");
+    printf("       --direct-io, optional, bypass page cache for write-behind output\n");
+    printf("       --sysmem, optional, no gpu: raw or y4m to raw or y4m of the same size in host memory,\n");
+    printf("                 color conversion on the cpu, no scaling or filters\n");
 }
 
 int main(int argc, char** argv)
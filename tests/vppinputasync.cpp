@@ -16,8 +16,7 @@
 #include "vppinputasync.h"
 
 VppInputAsync::VppInputAsync()
-    :m_cond(m_lock), m_eos(false),
-     m_queueSize(0),m_quit(false)
+    :m_started(false)
 {
 }
 
@@ -47,62 +46,40 @@ void* VppInputAsync::start(void* async)
 
 void VppInputAsync::loop()
 {
-    while (1) {
-        {
-            AutoLock lock(m_lock);
-            while (m_queue.size() >= m_queueSize) {
-                m_cond.wait();
-                if (m_quit)
-                    return;
-            }
-
-        }
-        SharedPtr<VideoFrame> frame;
-        bool ret = m_input->read(frame);
-        AutoLock lock(m_lock);
-        if (!ret) {
-           m_eos = true;
-           return;
-        }
-        m_queue.push_back(frame);
-        m_cond.signal();
-   }
+    SharedPtr<VideoFrame> frame;
+    while (m_input->read(frame)) {
+        //cancelled by destructor
+        if (!m_queue->push(frame))
+            return;
+        frame.reset();
+    }
+    m_queue->close();
 }
 
 bool VppInputAsync::init(const SharedPtr<VppInput>& input, uint32_t queueSize)
 {
     m_input = input;
-    m_queueSize = queueSize;
+    m_queue.reset(new FrameQueue(queueSize));
     if (pthread_create(&m_thread, NULL, start, this)) {
         ERROR("create thread failed");
         return false;
     }
+    m_started = true;
     return true;
 
 }
 
 bool VppInputAsync::read(SharedPtr<VideoFrame>& frame)
 {
-    AutoLock lock(m_lock);
-    while (m_queue.empty()) {
-        if (m_eos)
-            return false;
-        m_cond.wait();
-    }
-    frame = m_queue.front();
-    m_queue.pop_front();
-    m_cond.signal();
-    return true;
+    return m_queue->pop(frame);
 }
 
 VppInputAsync::~VppInputAsync()
 {
-    {
-        AutoLock lock(m_lock);
-        m_quit = true;
-        m_cond.signal();
+    if (m_started) {
+        m_queue->cancel();
+        pthread_join(m_thread, NULL);
     }
-    pthread_join(m_thread, NULL);
 }
 
 bool VppInputAsync::init(const char* inputFileName, uint32_t fourcc, int width, int height)
@@ -15,9 +15,7 @@
  */
 #ifndef vppinputasync_h
 #define vppinputasync_h
-#include "common/condition.h"
-#include "common/lock.h"
-#include <deque>
+#include "common/SpscQueue.h"
 
 #include "vppinputoutput.h"
 
@@ -46,17 +44,13 @@ private:
     static void* start(void* async);
     void loop();
 
-    Condition  m_cond;
-    Lock       m_lock;
     SharedPtr<VppInput> m_input;
-    bool       m_eos;
 
-    typedef std::deque<SharedPtr<VideoFrame> > FrameQueue;
-    FrameQueue m_queue;
-    uint32_t   m_queueSize;
+    typedef SpscQueue<SharedPtr<VideoFrame> > FrameQueue;
+    SharedPtr<FrameQueue> m_queue;
 
     pthread_t  m_thread;
-    bool       m_quit;
+    bool       m_started;
 
 };
 #endif //vppinputasync_h
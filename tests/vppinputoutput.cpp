@@ -26,6 +26,9 @@
 #include <va/va.h>
 #include "common/log.h"
 #include "common/lock.h"
+#include "common/CompressedFrameFile.h"
+#include "common/WriteBehindFile.h"
+#include "common/Y4MHeader.h"
 #include "vppinputoutput.h"
 #include "vppoutputencode.h"
 #include "vppinputdecode.h"
@@ -82,6 +85,7 @@ SharedPtr<VppInput> VppInput::create(const char* inputFileName, uint32_t fourcc,
 VppInputFile::VppInputFile()
     : m_fp(NULL)
     , m_readToEOS(false)
+    , m_y4m(false)
 {
 }
 
@@ -110,21 +114,42 @@ static bool guessFormat(const char* filename, uint32_t& fourcc, int& width, int&
     return true;
 }
 
+static uint32_t frameBytes(uint32_t fourcc, int width, int height)
+{
+    uint32_t byteWidth[3], byteHeight[3], planes;
+    if (!getPlaneResolution(fourcc, width, height, byteWidth, byteHeight, planes))
+        return 0;
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < planes; i++)
+        size += byteWidth[i] * byteHeight[i];
+    return size;
+}
+
 bool VppInputFile::init(const char* inputFileName, uint32_t fourcc, int width, int height)
 {
-    if(!fourcc || !width || !height)
+    //compressed dumps read as raw frames
+    m_fp = CompressedFrameFile::open(inputFileName);
+    if (!m_fp) {
+        fprintf(stderr, "fail to open input file: %s", inputFileName);
+        return false;
+    }
+
+    //y4m carries its own format
+    Y4MHeader y4m;
+    if (y4m.read(m_fp)) {
+        m_y4m = true;
+        fourcc = y4m.fourcc;
+        width = y4m.width;
+        height = y4m.height;
+    }
+    else if (!fourcc || !width || !height) {
         if (!guessFormat(inputFileName, fourcc, width, height))
             return false;
+    }
 
     m_width = width;
     m_height = height;
     m_fourcc = fourcc;
-
-    m_fp = fopen(inputFileName, "r");
-    if (!m_fp) {
-        fprintf(stderr, "fail to open input file: %s", inputFileName);
-        return false;
-    }
     return true;
 }
 
@@ -143,6 +168,10 @@ bool VppInputFile::read(SharedPtr<VideoFrame>& frame)
         return false;
     }
 
+    if (m_y4m && !Y4MHeader::readFrame(m_fp)) {
+        m_readToEOS = true;
+        return false;
+    }
     if (!m_reader->read(m_fp, frame))
         m_readToEOS = true;
     return !m_readToEOS;
@@ -172,7 +201,7 @@ SharedPtr<VppOutput> VppOutput::create(const char* outputFileName,
     if (output->init(outputFileName, fourcc, width, height, codecName, fps))
         return output;
     output.reset(new VppOutputFile);
-    if (output->init(outputFileName, fourcc, width, height, codecName))
+    if (output->init(outputFileName, fourcc, width, height, codecName, fps))
         return output;
     ERROR("can't open %s, wrong extension?",outputFileName);
     output.reset();
@@ -195,6 +224,10 @@ bool VppOutputFile::init(const char* outputFileName, uint32_t fourcc, int width,
         ERROR("output file name is null");
         return false;
     }
+    //y4m only carries planar formats, we write i420 for the others
+    m_y4m = Y4MHeader::isY4MName(outputFileName);
+    if (m_y4m && !Y4MHeader::colorspace(fourcc))
+        fourcc = YAMI_FOURCC_I420;
     if (!fourcc || !width || !height) {
         if (!guessFormat(outputFileName, fourcc, width, height)) {
             ERROR("can't guess format from %s", outputFileName);
@@ -204,11 +237,30 @@ bool VppOutputFile::init(const char* outputFileName, uint32_t fourcc, int width,
     m_fourcc = fourcc;
     m_width = width;
     m_height = height;
-    m_fp = fopen(outputFileName, "wb");
+    std::string header;
+    if (m_y4m) {
+        Y4MHeader y4m;
+        y4m.fourcc = fourcc;
+        y4m.width = width;
+        y4m.height = height;
+        y4m.fpsNum = fps > 0 ? fps : 30;
+        header = y4m.format();
+        if (header.empty())
+            return false;
+    }
+    if (CompressedFrameFile::enabled())
+        //one compressed frame per raw frame with its y4m frame header,
+        //the stream header in a frame of its own so it shifts none of them
+        m_fp = CompressedFrameFile::create(outputFileName, frameBytes(fourcc, width, height) + (m_y4m ? 6 : 0),
+            header.size());
+    else
+        m_fp = WriteBehindFile::open(outputFileName, "wb");
     if (!m_fp) {
         ERROR("fail to open input file: %s", outputFileName);
         return false;
     }
+    if (!header.empty() && fwrite(header.data(), 1, header.size(), m_fp) != header.size())
+        return false;
     return true;
 }
 
@@ -236,12 +288,22 @@ bool VppOutputFile::write(const SharedPtr<VideoFrame>& frame)
         ERROR("config with writer please!");
         return false;
     }
+    //eos, make sure all frames reach the file
     if (!frame)
-        return true;
+        return WriteBehindFile::flush(m_fp);
+    if (m_y4m) {
+        if ((int)frame->crop.width != m_width || (int)frame->crop.height != m_height) {
+            ERROR("y4m can't change size from %dx%d to %dx%d", m_width, m_height, frame->crop.width, frame->crop.height);
+            return false;
+        }
+        if (!Y4MHeader::writeFrame(m_fp))
+            return false;
+    }
     return m_writer->write(m_fp, frame);
 }
 
 VppOutputFile::VppOutputFile()
     :m_fp(NULL)
+    ,m_y4m(false)
 {
 }
@@ -19,10 +19,15 @@
 #include "common/log.h"
 #include "common/utils.h"
 #include "common/VaapiUtils.h"
+#include "common/VaapiMappedImage.h"
+#include "common/CpuColorConvert.h"
+#include "common/MappedFrameAllocator.h"
 #include "common/PooledFrameAllocator.h"
+#include "common/SystemMemoryFrameAllocator.h"
 #include <Yami.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <va/va.h>
 #ifndef ANDROID
 #include <va/va_drm.h>
@@ -65,12 +70,51 @@ public:
     virtual ~FrameWriter() {}
 };
 
-class VaapiFrameIO
+//moves one plane between memory and file with as few stdio calls as possible.
+//contiguous rows go in one call, others through a staging buffer.
+class PlaneIO
 {
 public:
     typedef bool (*FileIoFunc)(char* ptr, int size, FILE* fp);
-    VaapiFrameIO(const SharedPtr<VADisplay>& display, FileIoFunc io)
-        :m_display(display), m_io(io)
+    PlaneIO(FileIoFunc io, bool toMemory)
+        : m_io(io)
+        , m_toMemory(toMemory)
+    {
+    }
+    bool doIO(FILE* fp, char* ptr, uint32_t width, uint32_t height, uint32_t pitch)
+    {
+        uint32_t size = width * height;
+        if (!size)
+            return true;
+        if (pitch == width || height == 1)
+            return m_io(ptr, size, fp);
+        //keep the capacity, so we only allocate for the first frame
+        if (m_staging.size() < size)
+            m_staging.resize(size);
+        char* staging = &m_staging[0];
+        if (m_toMemory) {
+            if (!m_io(staging, size, fp))
+                return false;
+            for (uint32_t i = 0; i < height; i++)
+                memcpy(ptr + pitch * i, staging + width * i, width);
+            return true;
+        }
+        for (uint32_t i = 0; i < height; i++)
+            memcpy(staging + width * i, ptr + pitch * i, width);
+        return m_io(staging, size, fp);
+    }
+private:
+    FileIoFunc m_io;
+    bool m_toMemory;
+    std::vector<char> m_staging;
+};
+
+class VaapiFrameIO
+{
+public:
+    typedef PlaneIO::FileIoFunc FileIoFunc;
+    VaapiFrameIO(const SharedPtr<VADisplay>& display, FileIoFunc io, bool toMemory)
+        :m_display(display), m_planeIO(io, toMemory)
     {
 
     };
@@ -80,14 +124,6 @@ public:
             ERROR("invalid param");
             return false;
         }
-        VASurfaceID surface = (VASurfaceID)frame->surface;
-        VAImage image;
-
-        VAStatus status = vaDeriveImage(*m_display,surface,&image);
-        if (status != VA_STATUS_SUCCESS) {
-            ERROR("vaDeriveImage failed = %d", status);
-            return false;
-        }
         uint32_t byteWidth[3], byteHeight[3], planes;
         uint32_t byteX[3], byteY[3];
         //image.width is not equal to frame->crop.width.
@@ -100,34 +136,26 @@ public:
             ERROR("get left-top coordinate(%d,%d) failed", frame->crop.x, frame->crop.y);
             return false;
         }
-        char* buf;
-        status = vaMapBuffer(*m_display, image.buf, (void**)&buf);
-        if (status != VA_STATUS_SUCCESS) {
-            vaDestroyImage(*m_display, image.image_id);
-            ERROR("vaMapBuffer failed = %d", status);
+        //pool frames keep their mapping, others are unmapped on return
+        VaapiMappedImage mapped(*m_display);
+        char* buf = (char*)mapped.map(frame);
+        if (!buf) {
+            ERROR("failed to map surface %x", (VASurfaceID)frame->surface);
             return false;
         }
-        bool ret = true;
+        const VAImage& image = mapped.image();
         for (uint32_t i = 0; i < planes; i++) {
             char* ptr = buf + image.offsets[i];
-            ptr += image.pitches[i] * byteY[i];
-            int w = byteWidth[i];
-            for (uint32_t j = 0; j < byteHeight[i]; j++) {
-                ret = m_io(ptr + byteX[i], w, fp);
-                if (!ret)
-                    goto out;
-                ptr += image.pitches[i];
-            }
+            ptr += image.pitches[i] * byteY[i] + byteX[i];
+            if (!m_planeIO.doIO(fp, ptr, byteWidth[i], byteHeight[i], image.pitches[i]))
+                return false;
         }
-    out:
-        vaUnmapBuffer(*m_display, image.buf);
-        vaDestroyImage(*m_display, image.image_id);
-        return ret;
+        return true;
 
     }
 private:
     SharedPtr<VADisplay>  m_display;
-    FileIoFunc  m_io;
+    PlaneIO m_planeIO;
 };
 
 
@@ -135,7 +163,7 @@ class VaapiFrameReader:public FrameReader
 {
 public:
     VaapiFrameReader(const SharedPtr<VADisplay>& display)
-        :m_frameio(new VaapiFrameIO(display, readFromFile))
+        :m_frameio(new VaapiFrameIO(display, readFromFile, true))
     {
     }
     bool read(FILE* fp, const SharedPtr<VideoFrame>& frame)
@@ -154,7 +182,7 @@ class VaapiFrameWriter:public FrameWriter
 {
 public:
     VaapiFrameWriter(const SharedPtr<VADisplay>& display)
-        :m_frameio(new VaapiFrameIO(display, writeToFile))
+        :m_frameio(new VaapiFrameIO(display, writeToFile, false))
     {
     }
     bool write(FILE* fp, const SharedPtr<VideoFrame>& frame)
@@ -168,8 +196,188 @@ private:
         return fwrite(ptr, 1, size, fp) == (size_t)size;
     }
 };
+//converts the cropped part of a frame in host memory to fourcc and writes it packed
+class CpuConvertWriter
+{
+public:
+    CpuConvertWriter(uint32_t fourcc, uint32_t threads)
+        : m_fourcc(fourcc)
+        , m_convert(threads)
+    {
+    }
+    //frames of fourcc, and frames we can't convert, go to another writer
+    bool converts(const SharedPtr<VideoFrame>& frame) const
+    {
+        return frame->fourcc != m_fourcc && CpuColorConvert::isSupported(frame->fourcc, m_fourcc);
+    }
+    //base, offsets and pitches of the planes of frame
+    bool write(FILE* fp, const SharedPtr<VideoFrame>& frame, uint8_t* base, const uint32_t* offsets, const uint32_t* pitches)
+    {
+        uint32_t byteX[3], byteY[3], planes;
+        if (!getPlaneResolution(frame->fourcc, frame->crop.x, frame->crop.y, byteX, byteY, planes)) {
+            ERROR("get left-top coordinate(%d,%d) failed", frame->crop.x, frame->crop.y);
+            return false;
+        }
+        CpuImage src;
+        src.fourcc = frame->fourcc;
+        src.width = frame->crop.width;
+        src.height = frame->crop.height;
+        for (uint32_t i = 0; i < 3; i++) {
+            src.data[i] = i < planes ? base + offsets[i] + pitches[i] * byteY[i] + byteX[i] : NULL;
+            src.pitch[i] = i < planes ? pitches[i] : 0;
+        }
+
+        CpuImage dest;
+        uint32_t size = CpuColorConvert::layout(dest, m_fourcc, src.width, src.height, NULL);
+        if (m_buffer.size() < size)
+            m_buffer.resize(size);
+        CpuColorConvert::layout(dest, m_fourcc, src.width, src.height, &m_buffer[0]);
+        if (!m_convert.convert(dest, src))
+            return false;
+        return fwrite(&m_buffer[0], 1, size, fp) == size;
+    }
+private:
+    uint32_t m_fourcc;
+    CpuColorConvert m_convert;
+    std::vector<uint8_t> m_buffer;
+};
+
+//converts to fourcc on the cpu while writing, so no vpp surface is needed.
+//frames of fourcc, and frames we can't convert, are written as they are
+class VaapiConvertFrameWriter : public FrameWriter
+{
+public:
+    VaapiConvertFrameWriter(const SharedPtr<VADisplay>& display, uint32_t fourcc, uint32_t threads)
+        : m_display(display)
+        , m_convert(fourcc, threads)
+        , m_writer(display)
+    {
+    }
+    bool write(FILE* fp, const SharedPtr<VideoFrame>& frame)
+    {
+        if (!fp || !frame) {
+            ERROR("invalid param");
+            return false;
+        }
+        if (!m_convert.converts(frame))
+            return m_writer.write(fp, frame);
+
+        VaapiMappedImage mapped(*m_display);
+        uint8_t* buf = mapped.map(frame);
+        if (!buf) {
+            ERROR("failed to map surface %x", (VASurfaceID)frame->surface);
+            return false;
+        }
+        return m_convert.write(fp, frame, buf, mapped.image().offsets, mapped.image().pitches);
+    }
+private:
+    SharedPtr<VADisplay> m_display;
+    CpuConvertWriter m_convert;
+    VaapiFrameWriter m_writer;
+};
 //vaapi related operation end
 
+//host memory frames from SystemMemoryFrameAllocator, no gpu needed
+class SystemMemoryFrameIO
+{
+public:
+    typedef PlaneIO::FileIoFunc FileIoFunc;
+    SystemMemoryFrameIO(FileIoFunc io, bool toMemory)
+        : m_planeIO(io, toMemory)
+    {
+    }
+    bool doIO(FILE* fp, const SharedPtr<VideoFrame>& frame)
+    {
+        SystemMemoryFrame* mem = getSystemMemoryFrame(frame);
+        if (!fp || !mem) {
+            ERROR("invalid param");
+            return false;
+        }
+        uint32_t byteWidth[3], byteHeight[3], planes;
+        uint32_t byteX[3], byteY[3];
+        if (!getPlaneResolution(frame->fourcc, frame->crop.width, frame->crop.height, byteWidth, byteHeight, planes)) {
+            ERROR("get plane reoslution failed for %x, %dx%d", frame->fourcc, frame->crop.width, frame->crop.height);
+            return false;
+        }
+        if (!getPlaneResolution(frame->fourcc, frame->crop.x, frame->crop.y, byteX, byteY, planes)) {
+            ERROR("get left-top coordinate(%d,%d) failed", frame->crop.x, frame->crop.y);
+            return false;
+        }
+        for (uint32_t i = 0; i < planes; i++) {
+            char* ptr = (char*)mem->data + mem->offset[i];
+            ptr += mem->pitch[i] * byteY[i] + byteX[i];
+            if (!m_planeIO.doIO(fp, ptr, byteWidth[i], byteHeight[i], mem->pitch[i]))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    PlaneIO m_planeIO;
+};
+
+class SystemMemoryFrameReader : public FrameReader
+{
+public:
+    SystemMemoryFrameReader()
+        : m_frameio(new SystemMemoryFrameIO(readFromFile, true))
+    {
+    }
+    bool read(FILE* fp, const SharedPtr<VideoFrame>& frame)
+    {
+        return m_frameio->doIO(fp, frame);
+    }
+private:
+    SharedPtr<SystemMemoryFrameIO> m_frameio;
+    static bool readFromFile(char* ptr, int size, FILE* fp)
+    {
+        return fread(ptr, 1, size, fp) == (size_t)size;
+    }
+};
+
+class SystemMemoryFrameWriter : public FrameWriter
+{
+public:
+    SystemMemoryFrameWriter()
+        : m_frameio(new SystemMemoryFrameIO(writeToFile, false))
+    {
+    }
+    bool write(FILE* fp, const SharedPtr<VideoFrame>& frame)
+    {
+        return m_frameio->doIO(fp, frame);
+    }
+private:
+    SharedPtr<SystemMemoryFrameIO> m_frameio;
+    static bool writeToFile(char* ptr, int size, FILE* fp)
+    {
+        return fwrite(ptr, 1, size, fp) == (size_t)size;
+    }
+};
+
+//converts host memory frames to fourcc while writing, the gpu-less twin of VaapiConvertFrameWriter
+class SystemMemoryConvertFrameWriter : public FrameWriter
+{
+public:
+    SystemMemoryConvertFrameWriter(uint32_t fourcc, uint32_t threads)
+        : m_convert(fourcc, threads)
+    {
+    }
+    bool write(FILE* fp, const SharedPtr<VideoFrame>& frame)
+    {
+        SystemMemoryFrame* mem = getSystemMemoryFrame(frame);
+        if (!fp || !mem) {
+            ERROR("invalid param");
+            return false;
+        }
+        if (!m_convert.converts(frame))
+            return m_writer.write(fp, frame);
+        return m_convert.write(fp, frame, mem->data, mem->offset, mem->pitch);
+    }
+private:
+    CpuConvertWriter m_convert;
+    SystemMemoryFrameWriter m_writer;
+};
+
 class VppInput;
 class VppInputFile;
 
@@ -203,6 +411,8 @@ public:
 protected:
     FILE *m_fp;
     bool m_readToEOS;
+    //every frame starts with a FRAME line
+    bool m_y4m;
     SharedPtr<FrameReader> m_reader;
     SharedPtr<FrameAllocator> m_allocator;
 };
@@ -245,6 +455,7 @@ private:
     bool write(const SharedPtr<VideoFrame>& frame);
     SharedPtr<FrameWriter> m_writer;
     FILE* m_fp;
+    bool m_y4m;
 };
 
 #endif      //vppinputoutput_h
@@ -61,10 +61,38 @@ TranscodeParams::TranscodeParams()
     , oWidth(0)
     , oHeight(0)
     , fourcc(0)
+    , lowLatency(false)
 {
     /*nothing to do*/
 }
 
+TranscodeParams::Output::Output()
+    : oWidth(0)
+    , oHeight(0)
+    , bitRate(0)
+{
+}
+
+TranscodeParams TranscodeParams::forOutput(size_t i) const
+{
+    TranscodeParams para(*this);
+    para.moreOutputs.clear();
+    if (!i)
+        return para;
+    const Output& output = moreOutputs[i - 1];
+    para.outputFileName = output.fileName;
+    if (output.oWidth)
+        para.oWidth = output.oWidth;
+    if (output.oHeight)
+        para.oHeight = output.oHeight;
+    if (output.bitRate) {
+        para.m_encParams.bitRate = output.bitRate;
+        if (para.m_encParams.rcMode == RATE_CONTROL_CQP)
+            para.m_encParams.rcMode = RATE_CONTROL_CBR;
+    }
+    return para;
+}
+
 bool VppOutputEncode::init(const char* outputFileName, uint32_t fourcc,
     int width, int height, const char* codecName, int fps)
 {
@@ -87,6 +115,10 @@ void VppOutputEncode::initOuputBuffer()
     m_outputBuffer.format = OUTPUT_EVERYTHING;
     m_outputBuffer.data = &m_buffer[0];
 
+    std::deque<SharedPtr<CodedBuffer> > buffers;
+    for (uint32_t i = 0; i < CODED_POOL_SIZE; i++)
+        buffers.push_back(SharedPtr<CodedBuffer>(new CodedBuffer));
+    m_codedPool.reset(new VideoPool<CodedBuffer>(buffers));
 }
 
 static void setEncodeParam(const SharedPtr<IVideoEncoder>& encoder,
@@ -205,37 +237,108 @@ bool VppOutputEncode::config(NativeDisplay& nativeDisplay, const EncodeParams* e
     Encode_Status status = m_encoder->start();
     assert(status == ENCODE_SUCCESS);
     initOuputBuffer();
+    m_drain.reset(new EncoderDrain(m_encoder.get()));
     return true;
 }
 
-bool VppOutputEncode::output(const SharedPtr<VideoFrame>& frame)
+void VppOutputEncode::growOutputBuffer()
 {
-    Encode_Status status = ENCODE_SUCCESS;
-    bool drain = !frame;
-    if (frame) {
+    m_outputBuffer.bufferSize = (m_outputBuffer.bufferSize * 3) / 2;
+    m_buffer.resize(m_outputBuffer.bufferSize);
+    m_outputBuffer.data = &m_buffer[0];
+}
 
-        status = m_encoder->encode(frame);
-        if (status != ENCODE_SUCCESS) {
-            fprintf(stderr, "encode failed status = %d\n", status);
-            return false;
-        }
-    }
-    else {
-        m_encoder->flush();
-    }
+void VppOutputEncode::getOutput(bool drain)
+{
+    Encode_Status status;
     do {
         status = m_encoder->getOutput(&m_outputBuffer, drain);
         if (status == ENCODE_SUCCESS
             && !m_output->write(m_outputBuffer.data, m_outputBuffer.dataSize))
              assert(0);
 
-        if (status == ENCODE_BUFFER_TOO_SMALL) {
-            m_outputBuffer.bufferSize = (m_outputBuffer.bufferSize * 3) / 2;
-            m_buffer.resize(m_outputBuffer.bufferSize);
-            m_outputBuffer.data = &m_buffer[0];
-        }
+        if (status == ENCODE_BUFFER_TOO_SMALL)
+            growOutputBuffer();
 
     } while (status != ENCODE_BUFFER_NO_MORE);
+}
+
+bool VppOutputEncode::submit(const SharedPtr<VideoFrame>& frame)
+{
+    if (!frame) {
+        m_encoder->flush();
+        return true;
+    }
+    Encode_Status status = m_encoder->encode(frame);
+    if (status != ENCODE_SUCCESS) {
+        fprintf(stderr, "encode failed status = %d\n", status);
+        return false;
+    }
+    return true;
+}
+
+bool VppOutputEncode::encode(const SharedPtr<VideoFrame>& frame)
+{
+    Encode_Status status = m_drain->encode(frame);
+    if (status != ENCODE_SUCCESS) {
+        fprintf(stderr, "encode failed status = %d\n", status);
+        return false;
+    }
+    return true;
+}
+
+bool VppOutputEncode::getCoded(SharedPtr<CodedBuffer>& coded)
+{
+    //the encoder writes straight into a pooled buffer. when all of them are out,
+    //the writer lags, it writes into m_buffer and we copy the bitstream out
+    SharedPtr<CodedBuffer> pooled = m_codedPool->alloc();
+    std::vector<uint8_t>& buffer = pooled ? pooled->data : m_buffer;
+    if (buffer.size() < m_buffer.size())
+        buffer.resize(m_buffer.size());
+    Encode_Status status;
+    while (1) {
+        m_outputBuffer.data = &buffer[0];
+        m_outputBuffer.bufferSize = buffer.size();
+        status = m_drain->getOutput(&m_outputBuffer);
+        if (status != ENCODE_BUFFER_TOO_SMALL)
+            break;
+        buffer.resize(buffer.size() * 3 / 2);
+    }
+    if (status == ENCODE_BUFFER_NO_MORE) {
+        coded.reset();
+        return true;
+    }
+    if (status != ENCODE_SUCCESS) {
+        fprintf(stderr, "get encoded output failed status = %d\n", status);
+        return false;
+    }
+    if (pooled) {
+        coded = pooled;
+    }
+    else {
+        coded.reset(new CodedBuffer);
+        coded->data.assign(m_buffer.begin(), m_buffer.begin() + m_outputBuffer.dataSize);
+    }
+    coded->size = m_outputBuffer.dataSize;
+    coded->timeStamp = m_outputBuffer.timeStamp;
+    return true;
+}
+
+bool VppOutputEncode::write(const SharedPtr<CodedBuffer>& coded)
+{
+    if (!coded)
+        return m_output->flush();
+    return !coded->size || m_output->write(&coded->data[0], coded->size);
+}
+
+bool VppOutputEncode::output(const SharedPtr<VideoFrame>& frame)
+{
+    bool drain = !frame;
+    if (!submit(frame))
+        return false;
+    getOutput(drain);
+    if (drain)
+        return m_output->flush();
     return true;
 
 }
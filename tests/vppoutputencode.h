@@ -16,6 +16,8 @@
 #ifndef vppoutputencode_h
 #define vppoutputencode_h
 #include <Yami.h>
+#include "common/EncoderDrain.h"
+#include "common/videopool.h"
 #include "encodeinput.h"
 #include <string>
 #include <vector>
@@ -74,6 +76,38 @@ public:
     uint32_t fourcc;
     string inputFileName;
     string outputFileName;
+
+    //more outputs encoded from the same decoded frames, like the rungs of an abr ladder.
+    //zero fields take the values above
+    struct Output {
+        Output();
+        string fileName;
+        uint32_t oWidth;
+        uint32_t oHeight;
+        int32_t bitRate;
+    };
+    std::vector<Output> moreOutputs;
+    //params of output i, 0 is the one above
+    TranscodeParams forOutput(size_t i) const;
+    //what the queues after the input do when the outputs lag behind a live input
+    OverloadPolicy overload;
+    //no B frames, one frame queued between stages, the decoder outputs frames asap
+    bool lowLatency;
+    //--affinity, a CpuAffinity spec, empty to run anywhere
+    string affinity;
+};
+
+//the bitstream of one frame, timeStamp is the one of the frame
+struct CodedBuffer {
+    CodedBuffer()
+        : size(0)
+        , timeStamp(0)
+    {
+    }
+    //pooled buffers are larger than the bitstream, size bytes of data are used
+    std::vector<uint8_t> data;
+    uint32_t size;
+    int64_t timeStamp;
 };
 
 class VppOutputEncode : public VppOutput
@@ -82,16 +116,37 @@ public:
     virtual bool output(const SharedPtr<VideoFrame>& frame);
     virtual ~VppOutputEncode(){}
     bool config(NativeDisplay& nativeDisplay, const EncodeParams* encParam = NULL);
+
+    //output() split over three threads, so the encoder keeps several frames in flight
+    //while the bitstream is taken out and written. do not mix them with output().
+    //submit a frame, waits while the encoder is full
+    bool encode(const SharedPtr<VideoFrame>& frame);
+    //blocks till the next coded buffer, coded is NULL after the last one
+    bool getCoded(SharedPtr<CodedBuffer>& coded);
+    //write a buffer from getCoded(), NULL waits until everything reaches the file
+    bool write(const SharedPtr<CodedBuffer>& coded);
+    //close it after the last encode(), cancel it to wake up encode() and getCoded()
+    SharedPtr<EncoderDrain> drain() const { return m_drain; }
 protected:
     virtual bool init(const char* outputFileName, uint32_t fourcc, int width,
         int height, const char* codecName, int fps = 30);
 
 private:
     void initOuputBuffer();
+    void growOutputBuffer();
+    //the one being written, the one being filled and a few queued, more are copied
+    static const uint32_t CODED_POOL_SIZE = 4;
+    //encode the frame, or flush the encoder for NULL
+    bool submit(const SharedPtr<VideoFrame>& frame);
+    //write the coded buffers
+    void getOutput(bool drain);
     const char* m_mime;
     SharedPtr<IVideoEncoder> m_encoder;
+    SharedPtr<EncoderDrain> m_drain;
     VideoEncOutputBuffer m_outputBuffer;
     std::vector<uint8_t> m_buffer;
+    //getCoded() has the encoder write into these
+    SharedPtr<VideoPool<CodedBuffer> > m_codedPool;
     SharedPtr<EncodeOutput> m_output;
 };
 
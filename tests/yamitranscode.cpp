@@ -21,21 +21,49 @@
 #include "vppinputoutput.h"
 #include "vppoutputencode.h"
 #include "encodeinput.h"
-#include "tests/vppinputasync.h"
+#include "pipelinestages.h"
 #include "common/log.h"
+#include "common/CpuAffinity.h"
+#include "common/PoolStats.h"
+#include "common/WriteBehindFile.h"
 #include <Yami.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace YamiMediaCodec;
 
+//command lines of the jobs, from --jobs and --job
+static std::vector<std::string> s_jobs;
+//how many jobs run at the same time, 0 for one per cpu
+static uint32_t s_parallel = 0;
+//stage threads of all jobs, 0 for two per cpu
+static uint32_t s_stageThreads = 0;
+//socket the daemon listens on, from --daemon
+static std::string s_daemon;
+//socket of a daemon to send the jobs to, from --connect
+static std::string s_connect;
+static bool s_shutdown = false;
+//--pool-stats, its dump thread starts after --affinity is applied
+static std::string s_poolStats;
+
 static void print_help(const char* app)
 {
     printf("%s <options>\n", app);
-    printf("   -i <source filename> load a raw yuv file or a compressed video file\n");
+    printf("   -i <source filename> load a raw yuv file, a y4m file or a compressed video file\n");
     printf("   -W <width> -H <height>\n");
-    printf("   -o <coded file> optional\n");
+    printf("   -o <coded file> optional, a .y4m file gets raw frames with a y4m header\n");
+    printf("      repeat it for more outputs from one decode, -b --ow --oh after it apply to that output\n");
     printf("   -b <bitrate: kbps> optional\n");
     printf("   -f <frame rate> optional\n");
     printf("   -c <codec: HEVC|AVC|VP8|JPEG>\n");
@@ -66,6 +94,22 @@ static void print_help(const char* app)
     printf("   --lowpower <Enable AVC low power mode (default 0, Disabled)> optional\n");
     printf("   --quality-level <encoded video qulity level(default 0), range[%d, %d]> optional\n",
         VIDEO_PARAMS_QUALITYLEVEL_NONE, VIDEO_PARAMS_QUALITYLEVEL_MAX);
+    printf("   --pool-stats <json file to dump frame pool usage at exit and on SIGUSR1, - for stderr> optional\n");
+    printf("   --affinity <node:N | cpu list like 0-3,8, pin threads there and allocate host buffers on that numa node> optional\n");
+    printf("   --write-behind <number of 4M buffers queued for a writer thread, 0: write in place (default)> optional\n");
+    printf("   --direct-io <bypass page cache for write-behind output> optional\n");
+    printf("   --jobs <manifest file, one job per line with the options above, # starts a comment> optional\n");
+    printf("   --job <\"options of one job\", can be repeated> optional\n");
+    printf("   --parallel <number of jobs running at the same time (default one per cpu)> optional\n");
+    printf("   --stage-threads <pipeline stage threads of all jobs together, a job starts when all of its stages get one (default two per cpu)> optional\n");
+    printf("   --drop <oldest | newest | latest | halve, drop frames instead of waiting when the outputs lag, for live input> optional\n");
+    printf("   --drop-depth <drop with this many frames waiting for an output, up to %d (default)> optional\n", FRAME_QUEUE_DEPTH);
+    printf("   --drop-age <drop once a frame waited this many ms for an output (default 0, no limit)> optional\n");
+    printf("   --lowlatency <no B frames, one frame queued between stages, report read to bitstream latency> optional\n");
+    printf("   --daemon <unix socket path, run jobs sent to it till shut down> optional\n");
+    printf("   --connect <unix socket path of a daemon, send it the jobs and print its replies> optional\n");
+    printf("   --shutdown <with --connect, stop the daemon after its running jobs> optional\n");
+    printf("       jobs share one display, per job latency and total frames/s are printed at the end\n");
     printf("   VP9 encoder specific options:\n");
     printf("   --refmode <VP9 Reference frames mode (default 0 last(previous), "
            "gold/alt (previous key frame) | 1 last (previous) gold (one before "
@@ -96,7 +140,24 @@ static VideoRateControl string_to_rc_mode(char *str)
     return rcMode;
 }
 
-static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
+static bool readManifest(const char* path)
+{
+    std::ifstream manifest(path);
+    if (!manifest) {
+        fprintf(stderr, "can't open job manifest %s\n", path);
+        return false;
+    }
+    std::string line;
+    while (std::getline(manifest, line)) {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") != std::string::npos)
+            s_jobs.push_back(line);
+    }
+    return true;
+}
+
+//inJob: parsing the options of one job, no nested jobs there
+static bool processCmdLine(int argc, char *argv[], TranscodeParams& para, bool inJob = false)
 {
     char opt;
     const struct option long_opts[] = {
@@ -128,6 +189,21 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
         { "vbv-buffer-fullness", required_argument, NULL, 0 },
         { "vbv-buffer-size", required_argument, NULL, 0 },
         { "quality-level", required_argument, NULL, 0 },
+        { "pool-stats", required_argument, NULL, 0 },
+        { "affinity", required_argument, NULL, 0 },
+        { "write-behind", required_argument, NULL, 0 },
+        { "direct-io", no_argument, NULL, 0 },
+        { "jobs", required_argument, NULL, 0 },
+        { "job", required_argument, NULL, 0 },
+        { "parallel", required_argument, NULL, 0 },
+        { "daemon", required_argument, NULL, 0 },
+        { "connect", required_argument, NULL, 0 },
+        { "shutdown", no_argument, NULL, 0 },
+        { "drop", required_argument, NULL, 0 },
+        { "drop-depth", required_argument, NULL, 0 },
+        { "drop-age", required_argument, NULL, 0 },
+        { "lowlatency", no_argument, NULL, 0 },
+        { "stage-threads", required_argument, NULL, 0 },
         { NULL, no_argument, NULL, 0 }
     };
     int option_index;
@@ -148,7 +224,13 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
             para.inputFileName = optarg;
             break;
         case 'o':
-            para.outputFileName = optarg;
+            if (para.outputFileName.empty()) {
+                para.outputFileName = optarg;
+            }
+            else {
+                para.moreOutputs.push_back(TranscodeParams::Output());
+                para.moreOutputs.back().fileName = optarg;
+            }
             break;
         case 'W':
             para.iWidth = atoi(optarg);
@@ -157,7 +239,10 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
             para.iHeight = atoi(optarg);
             break;
         case 'b':
-            para.m_encParams.bitRate = atoi(optarg) * 1024;//kbps to bps
+            if (!para.moreOutputs.empty())
+                para.moreOutputs.back().bitRate = atoi(optarg) * 1024;
+            else
+                para.m_encParams.bitRate = atoi(optarg) * 1024;//kbps to bps
             break;
         case 'f':
             para.m_encParams.fps = atoi(optarg);
@@ -223,10 +308,16 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
                     para.m_encParams.m_encParamsVP9.referenceMode = atoi(optarg);
                     break;
                 case 16:
-                    para.oWidth = atoi(optarg);
+                    if (!para.moreOutputs.empty())
+                        para.moreOutputs.back().oWidth = atoi(optarg);
+                    else
+                        para.oWidth = atoi(optarg);
                     break;
                 case 17:
-                    para.oHeight = atoi(optarg);
+                    if (!para.moreOutputs.empty())
+                        para.moreOutputs.back().oHeight = atoi(optarg);
+                    else
+                        para.oHeight = atoi(optarg);
                     break;
                 case 18:
                     para.m_encParams.layerBitRate[0] = atoi(optarg) * 1024;//kbps to bps;
@@ -258,6 +349,70 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
                 case 27:
                     para.m_encParams.qualityLevel = atoi(optarg);
                     break;
+                case 28:
+                case 30:
+                case 31:
+                case 34:
+                case 42:
+                    if (inJob) {
+                        fprintf(stderr, "--%s is for the whole process, a job can't set it\n", long_opts[option_index].name);
+                        return false;
+                    }
+                    if (option_index == 28)
+                        s_poolStats = optarg;
+                    else if (option_index == 30)
+                        WriteBehindFile::setQueueDepth(atoi(optarg));
+                    else if (option_index == 31)
+                        WriteBehindFile::setDirectIO(true);
+                    else if (option_index == 34)
+                        s_parallel = atoi(optarg);
+                    else
+                        s_stageThreads = atoi(optarg);
+                    break;
+                case 29:
+                    //in a job, applied on the thread of the job only
+                    para.affinity = optarg;
+                    break;
+                case 32:
+                case 33:
+                    if (inJob) {
+                        fprintf(stderr, "a job can't have jobs\n");
+                        return false;
+                    }
+                    if (option_index == 33)
+                        s_jobs.push_back(optarg);
+                    else if (!readManifest(optarg))
+                        return false;
+                    break;
+                case 35:
+                case 36:
+                case 37:
+                    if (inJob) {
+                        fprintf(stderr, "a job can't control the daemon\n");
+                        return false;
+                    }
+                    if (option_index == 35)
+                        s_daemon = optarg;
+                    else if (option_index == 36)
+                        s_connect = optarg;
+                    else
+                        s_shutdown = true;
+                    break;
+                case 38:
+                    if (!para.overload.parse(optarg)) {
+                        fprintf(stderr, "unknown drop policy %s\n", optarg);
+                        return false;
+                    }
+                    break;
+                case 39:
+                    para.overload.depth = atoi(optarg);
+                    break;
+                case 40:
+                    para.overload.ageMs = atoi(optarg);
+                    break;
+                case 41:
+                    para.lowLatency = true;
+                    break;
             }
         }
     }
@@ -271,6 +426,14 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
         return false;
     }
 
+    if (s_shutdown && s_connect.empty()) {
+        fprintf(stderr, "--shutdown needs --connect\n");
+        return false;
+    }
+    //the jobs have their own input
+    if (!inJob && (!s_jobs.empty() || !s_daemon.empty() || !s_connect.empty()))
+        return true;
+
     if (para.inputFileName.empty()) {
         fprintf(stderr, "can not encode without input file\n");
         return false;
@@ -295,6 +458,10 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
     if (!strncmp(para.inputFileName.c_str(), "/dev/video", strlen("/dev/video")) && !para.frameCount)
         para.frameCount = 50;
 
+    //B frames wait for the next P frame
+    if (para.lowLatency && para.m_encParams.ipPeriod > 1)
+        para.m_encParams.ipPeriod = 1;
+
     if (!para.oWidth)
         para.oWidth = para.iWidth;
     if (!para.oHeight)
@@ -313,24 +480,30 @@ SharedPtr<VppInput> createInput(TranscodeParams& para, const SharedPtr<VADisplay
     SharedPtr<VppInputFile> inputFile = DynamicPointerCast<VppInputFile>(input);
     if (inputFile) {
         SharedPtr<FrameReader> reader(new VaapiFrameReader(display));
-        SharedPtr<FrameAllocator> alloctor(new PooledFrameAllocator(display, 5));
+        SharedPtr<FrameAllocator> alloctor(new MappedFrameAllocator(display, 5));
+        alloctor = instrumentAllocator("input", alloctor, 5);
         if(!inputFile->config(alloctor, reader)) {
             ERROR("config input failed");
             input.reset();
         }
+        //y4m input has its size in the header, use it when the options and output name have none
+        int width, height;
+        if ((!para.oWidth || !para.oHeight) && !guessResolution(para.outputFileName.c_str(), width, height)) {
+            para.oWidth = inputFile->getWidth();
+            para.oHeight = inputFile->getHeight();
+        }
     }
     SharedPtr<VppInputDecode> inputDecode = DynamicPointerCast<VppInputDecode>(input);
     if (inputDecode) {
         NativeDisplay nativeDisplay;
         nativeDisplay.type = NATIVE_DISPLAY_VA;
         nativeDisplay.handle = (intptr_t)*display;
+        inputDecode->setLowLatency(para.lowLatency);
         if(!inputDecode->config(nativeDisplay)) {
             ERROR("config input decode failed");
             input.reset();
         }
     }
-    if (input)
-        input = VppInputAsync::create(input, 3); //make input in other thread.
     return input;
 }
 
@@ -362,15 +535,130 @@ SharedPtr<VppOutput> createOutput(TranscodeParams& para, const SharedPtr<VADispl
     return output;
 }
 
-SharedPtr<FrameAllocator> createAllocator(const SharedPtr<VppOutput>& output, const SharedPtr<VADisplay>& display, int32_t extraSize)
+//Vpp instances and output surface pools of finished jobs. A later job with
+//the same output format takes them instead of creating and allocating its own.
+class WarmPool
 {
-    uint32_t fourcc;
-    int width, height;
-    SharedPtr<FrameAllocator> allocator(new PooledFrameAllocator(display, std::max(extraSize, 5)));
-    if (!output->getFormat(fourcc, width, height)
-        || !allocator->setFormat(fourcc, width,height)) {
-        allocator.reset();
+public:
+    struct Format {
+        Format()
+            : fourcc(0)
+            , width(0)
+            , height(0)
+            , size(0)
+        {
+        }
+        bool operator==(const Format& other) const
+        {
+            return fourcc == other.fourcc && width == other.width
+                && height == other.height && size == other.size;
+        }
+        uint32_t fourcc;
+        int width;
+        int height;
+        int size;
+    };
+
+    SharedPtr<IVideoPostProcess> takeVpp()
+    {
+        AutoLock lock(m_lock);
+        SharedPtr<IVideoPostProcess> vpp;
+        if (!m_vpps.empty()) {
+            vpp = m_vpps.back();
+            m_vpps.pop_back();
+        }
+        return vpp;
+    }
+
+    void putVpp(const SharedPtr<IVideoPostProcess>& vpp)
+    {
+        AutoLock lock(m_lock);
+        if (m_vpps.size() < MAX_IDLE)
+            m_vpps.push_back(vpp);
+    }
+
+    SharedPtr<FrameAllocator> takeAllocator(const Format& format)
+    {
+        AutoLock lock(m_lock);
+        SharedPtr<FrameAllocator> allocator;
+        for (size_t i = 0; i < m_allocators.size(); i++) {
+            if (m_allocators[i].first == format) {
+                allocator = m_allocators[i].second;
+                m_allocators.erase(m_allocators.begin() + i);
+                break;
+            }
+        }
+        return allocator;
+    }
+
+    //all frames must be back, the next job gets the whole pool
+    void putAllocator(const Format& format, const SharedPtr<FrameAllocator>& allocator)
+    {
+        AutoLock lock(m_lock);
+        //the oldest idle surfaces go first
+        if (m_allocators.size() >= MAX_IDLE)
+            m_allocators.pop_front();
+        m_allocators.push_back(std::make_pair(format, allocator));
+    }
+
+private:
+    static const size_t MAX_IDLE = 16;
+    Lock m_lock;
+    std::vector<SharedPtr<IVideoPostProcess> > m_vpps;
+    std::deque<std::pair<Format, SharedPtr<FrameAllocator> > > m_allocators;
+};
+
+//pins the calling thread, threads it creates afterwards inherit the affinity
+static bool applyAffinity(const std::string& spec)
+{
+    if (spec.empty())
+        return true;
+    CpuAffinity affinity;
+    return affinity.parse(spec.c_str()) && affinity.apply();
+}
+
+//once all options are parsed and before any thread starts, so every thread inherits the affinity
+static bool applyProcessOptions(const TranscodeParams& para)
+{
+    if (!applyAffinity(para.affinity))
+        return false;
+    if (!s_poolStats.empty() && !PoolStatsRegistry::instance().setOutput(s_poolStats.c_str()))
+        return false;
+    //the stages of a job mostly wait for the gpu, but five of them for each output
+    //of each of one job per cpu would be far more threads than the cpus and engines serve
+    uint32_t stageThreads = s_stageThreads;
+    if (!stageThreads)
+        stageThreads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    StageThreadLimit::instance().setLimit(stageThreads);
+    return true;
+}
+
+//frames queued between two stages
+static uint32_t queueDepth(const TranscodeParams& para)
+{
+    return para.lowLatency ? 1 : FRAME_QUEUE_DEPTH;
+}
+
+SharedPtr<FrameAllocator> createAllocator(const SharedPtr<VppOutput>& output, const SharedPtr<VADisplay>& display,
+    int32_t extraSize, uint32_t queueDepth, WarmPool* warm, WarmPool::Format& format)
+{
+    SharedPtr<FrameAllocator> allocator;
+    //frames held by the encoder, the vpp stage and the queue between them
+    format.size = std::max(extraSize, 5) + queueDepth;
+    if (!output->getFormat(format.fourcc, format.width, format.height)) {
         ERROR("get Format failed");
+        return allocator;
+    }
+    if (warm) {
+        allocator = warm->takeAllocator(format);
+        if (allocator)
+            return allocator;
+    }
+    allocator.reset(new MappedFrameAllocator(display, format.size));
+    allocator = instrumentAllocator("vpp-output", allocator, format.size);
+    if (!allocator->setFormat(format.fourcc, format.width, format.height)) {
+        allocator.reset();
+        ERROR("set Format failed");
     }
     return allocator;
 }
@@ -378,91 +666,830 @@ SharedPtr<FrameAllocator> createAllocator(const SharedPtr<VppOutput>& output, co
 class TranscodeTest
 {
 public:
-    bool init(int argc, char* argv[])
+    //warm: take vpp and surfaces from it, and give them back when done
+    explicit TranscodeTest(WarmPool* warm = NULL)
+        : m_warm(warm)
+        , m_frames(0)
+    {
+    }
+
+    ~TranscodeTest()
+    {
+        if (!m_warm)
+            return;
+        for (size_t i = 0; i < m_branches.size(); i++) {
+            Branch& branch = m_branches[i];
+            //the encoder holds frames of the pool
+            branch.output.reset();
+            if (branch.vpp)
+                m_warm->putVpp(branch.vpp);
+            if (branch.allocator)
+                m_warm->putAllocator(branch.format, branch.allocator);
+        }
+    }
+
+    //the display may be shared by many jobs
+    bool init(const TranscodeParams& para, const SharedPtr<VADisplay>& display)
+    {
+        m_cmdParam = para;
+        m_display = display;
+        m_input = createInput(m_cmdParam, m_display);
+        if (!m_input) {
+            ERROR("create input failed");
+            return false;
+        }
+        //one vpp and encoder branch for each output, they share the decoded frames
+        for (size_t i = 0; i <= m_cmdParam.moreOutputs.size(); i++) {
+            TranscodeParams outputParam = m_cmdParam.forOutput(i);
+            Branch branch;
+            branch.vpp = createVpp();
+            if (!branch.vpp) {
+                ERROR("create vpp failed");
+                return false;
+            }
+            branch.output = createOutput(outputParam, m_display, m_input->getFourcc());
+            if (!branch.output) {
+                ERROR("create output %s failed", outputParam.outputFileName.c_str());
+                return false;
+            }
+            m_branches.push_back(branch);
+            Branch& added = m_branches.back();
+            added.allocator = createAllocator(added.output, m_display, outputParam.m_encParams.ipPeriod,
+                queueDepth(outputParam), m_warm, added.format);
+            if (!added.allocator)
+                return false;
+        }
+        return true;
+    }
+
+    //input, vpp, encode and write run on their own threads
+    bool run(const std::string& name = "pipeline")
+    {
+        Pipeline pipeline(name);
+        FrameQueues decoded;
+        for (size_t i = 0; i < m_branches.size(); i++)
+            decoded.push_back(pipeline.createQueue<SharedPtr<VideoFrame> >(queueDepth(m_cmdParam), m_cmdParam.overload));
+        SharedPtr<InputStage> input(new InputStage(m_input, decoded, m_cmdParam.frameCount));
+        {
+            AutoLock lock(m_lock);
+            m_inputStage = input;
+        }
+        pipeline.add(input, std::vector<SharedPtr<Pipeline::QueueBase> >(decoded.begin(), decoded.end()));
+        //every output has its own latencies
+        std::vector<SharedPtr<FrameTrace> > traces;
+        for (size_t i = 0; i < m_branches.size(); i++) {
+            const Branch& branch = m_branches[i];
+            SharedPtr<FrameTrace> trace = createFrameTrace();
+            traces.push_back(trace);
+            input->addTrace(trace);
+            SharedPtr<FrameQueue> processed = pipeline.createQueue<SharedPtr<VideoFrame> >(queueDepth(m_cmdParam));
+            SharedPtr<VppStage> vpp(new VppStage(branch.vpp, branch.allocator, decoded[i], processed));
+            vpp->addTrace(trace);
+            pipeline.add(vpp, processed);
+            addOutputStages(pipeline, branch.output, processed, true, trace);
+        }
+        bool ret = pipeline.run();
+        for (size_t i = 0; i < traces.size(); i++) {
+            const std::string& output = m_cmdParam.forOutput(i).outputFileName;
+            traces[i]->report(name + " " + output);
+            if (m_cmdParam.lowLatency)
+                printf("%s read to bitstream: %s\n", output.c_str(), traces[i]->latency(TRACE_BITSTREAM).c_str());
+        }
+        m_frames = input->items();
+        return ret;
+    }
+
+    //frames read from the input in run()
+    uint64_t frames() const { return m_frames; }
+
+    //frames read so far, from any thread while run() works
+    uint64_t progress()
+    {
+        AutoLock lock(m_lock);
+        return m_inputStage ? m_inputStage->items() : 0;
+    }
+
+private:
+    struct Branch {
+        SharedPtr<IVideoPostProcess> vpp;
+        SharedPtr<VppOutput> output;
+        SharedPtr<FrameAllocator> allocator;
+        WarmPool::Format format;
+    };
+
+    SharedPtr<IVideoPostProcess> createVpp()
+    {
+        if (m_warm) {
+            SharedPtr<IVideoPostProcess> vpp = m_warm->takeVpp();
+            if (vpp)
+                return vpp;
+        }
+        NativeDisplay nativeDisplay;
+        nativeDisplay.type = NATIVE_DISPLAY_VA;
+        nativeDisplay.handle = (intptr_t)*m_display;
+        SharedPtr<IVideoPostProcess> vpp(createVideoPostProcess(YAMI_VPP_SCALER), releaseVideoPostProcess);
+        if (vpp && vpp->setNativeDisplay(nativeDisplay) != YAMI_SUCCESS)
+            vpp.reset();
+        return vpp;
+    }
+
+    WarmPool* m_warm;
+    SharedPtr<VADisplay> m_display;
+    SharedPtr<VppInput> m_input;
+    std::vector<Branch> m_branches;
+    TranscodeParams m_cmdParam;
+    uint64_t m_frames;
+    Lock m_lock;
+    SharedPtr<InputStage> m_inputStage;
+};
+
+//processCmdLine() for one job, getopt is not reentrant
+static bool parseJob(char* app, const std::string& line, TranscodeParams& para)
+{
+    static Lock parseLock;
+    std::istringstream stream(line);
+    std::vector<std::string> args;
+    std::string arg;
+    while (stream >> arg)
+        args.push_back(arg);
+    std::vector<char*> argv;
+    argv.push_back(app);
+    for (size_t i = 0; i < args.size(); i++)
+        argv.push_back(&args[i][0]);
+    argv.push_back(NULL);
+    AutoLock lock(parseLock);
+    //restart getopt for a new command line
+    optind = 0;
+    return processCmdLine(argv.size() - 1, &argv[0], para, true);
+}
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//Many transcodes in one process on one display, instead of a process,
+//a drm fd and a vaInitialize for each. At most --parallel jobs run at
+//once, each worker takes the next job when its current one is done.
+//A job's pipeline also waits till all its stages fit in --stage-threads.
+class TranscodeJobs
+{
+public:
+    TranscodeJobs()
+        : m_next(0)
+        , m_start(0)
+    {
+    }
+
+    bool init(char* app)
+    {
+        for (size_t i = 0; i < s_jobs.size(); i++) {
+            Job job;
+            if (!parseJob(app, s_jobs[i], job.para)) {
+                fprintf(stderr, "bad job %d: %s\n", (int)i + 1, s_jobs[i].c_str());
+                return false;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "job %d", (int)i + 1);
+            job.name = name;
+            m_jobs.push_back(job);
+        }
+        m_display = createVADisplay();
+        if (!m_display) {
+            ERROR("create display failed");
+            return false;
+        }
+        return true;
+    }
+
+    bool run()
+    {
+        uint32_t workers = s_parallel;
+        if (!workers)
+            workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers > m_jobs.size())
+            workers = m_jobs.size();
+        m_start = now();
+        std::vector<pthread_t> threads;
+        for (uint32_t i = 0; i < workers; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, start, this)) {
+                ERROR("create job worker failed");
+                break;
+            }
+            threads.push_back(thread);
+        }
+        //no worker at all, do them here
+        if (threads.empty())
+            loop();
+        for (size_t i = 0; i < threads.size(); i++)
+            pthread_join(threads[i], NULL);
+        return report(now() - m_start);
+    }
+
+private:
+    struct Job {
+        Job()
+            : begin(0)
+            , end(0)
+            , frames(0)
+            , ok(false)
+        {
+        }
+        TranscodeParams para;
+        std::string name;
+        uint64_t begin;
+        uint64_t end;
+        uint64_t frames;
+        bool ok;
+    };
+
+    static void* start(void* jobs)
+    {
+        ((TranscodeJobs*)jobs)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        size_t i;
+        while ((i = __atomic_fetch_add(&m_next, 1, __ATOMIC_RELAXED)) < m_jobs.size())
+            runJob(m_jobs[i]);
+    }
+
+    //a job with its own --affinity runs on a thread of its own, pinned before the
+    //pipeline starts, so the worker is not left pinned for its next job
+    void runJob(Job& job)
+    {
+        job.begin = now();
+        if (job.para.affinity.empty()) {
+            transcode(job);
+        }
+        else {
+            PinnedJob pinned = { this, &job };
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, startPinned, &pinned))
+                ERROR("create thread for %s failed", job.name.c_str());
+            else
+                pthread_join(thread, NULL);
+        }
+        job.end = now();
+        if (!job.ok)
+            ERROR("%s failed", job.name.c_str());
+    }
+
+    struct PinnedJob {
+        TranscodeJobs* jobs;
+        Job* job;
+    };
+
+    static void* startPinned(void* arg)
     {
-        if (!processCmdLine(argc, argv, m_cmdParam))
+        PinnedJob* pinned = (PinnedJob*)arg;
+        if (applyAffinity(pinned->job->para.affinity))
+            pinned->jobs->transcode(*pinned->job);
+        return NULL;
+    }
+
+    void transcode(Job& job)
+    {
+        //everything of the job is released before the next one starts
+        TranscodeTest trans(&m_warm);
+        job.ok = trans.init(job.para, m_display) && trans.run(job.name);
+        job.frames = trans.frames();
+    }
+
+    bool report(uint64_t elapsed)
+    {
+        uint64_t frames = 0;
+        uint32_t failed = 0;
+        printf("%-8s %8s %10s %10s %10s  %s\n", "job", "frames", "wait(s)", "run(s)", "fps", "output");
+        for (size_t i = 0; i < m_jobs.size(); i++) {
+            const Job& job = m_jobs[i];
+            double seconds = (job.end - job.begin) / 1e9;
+            printf("%-8s %8llu %10.3f %10.3f %10.2f  %s%s\n", job.name.c_str(), (unsigned long long)job.frames,
+                (job.begin - m_start) / 1e9, seconds, seconds > 0 ? job.frames / seconds : 0,
+                job.para.outputFileName.c_str(), job.ok ? "" : " FAILED");
+            frames += job.frames;
+            if (!job.ok)
+                failed++;
+        }
+        printf("%d jobs, %d failed, %llu frames in %.3f seconds, %.2f frames/s\n", (int)m_jobs.size(), failed,
+            (unsigned long long)frames, elapsed / 1e9, elapsed ? frames / (elapsed / 1e9) : 0);
+        return !failed;
+    }
+
+    SharedPtr<VADisplay> m_display;
+    WarmPool m_warm;
+    std::vector<Job> m_jobs;
+    size_t m_next;
+    uint64_t m_start;
+};
+
+//Messages on the daemon socket are a 4 byte big endian length and that many
+//bytes of text. A client sends one request per connection:
+//    "job <options>"  replies "accepted", "progress <frames>" every half
+//                     second while it runs, then "done ok|failed <frames> <seconds>"
+//    "shutdown"       replies "ok", running jobs finish, new ones are refused
+//bad requests get "error <reason>". The connection is closed after the last reply,
+//or when no request came within 5 seconds of connecting.
+static const uint32_t MAX_MESSAGE = 64 * 1024;
+
+static bool sendAll(int fd, const char* data, size_t size)
+{
+    while (size) {
+        //no SIGPIPE if the other side went away
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
             return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool recvAll(int fd, char* data, size_t size)
+{
+    while (size) {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeMessage(int fd, const std::string& message)
+{
+    uint32_t size = message.size();
+    if (size > MAX_MESSAGE)
+        return false;
+    char header[4] = { (char)(size >> 24), (char)(size >> 16), (char)(size >> 8), (char)size };
+    return sendAll(fd, header, sizeof(header)) && sendAll(fd, message.data(), size);
+}
+
+//false on eof or a broken message
+static bool readMessage(int fd, std::string& message)
+{
+    uint8_t header[4];
+    if (!recvAll(fd, (char*)header, sizeof(header)))
+        return false;
+    uint32_t size = (header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+    if (size > MAX_MESSAGE)
+        return false;
+    message.resize(size);
+    return !size || recvAll(fd, &message[0], size);
+}
 
+static bool socketAddress(const std::string& path, struct sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "bad socket path %s\n", path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+//-1 on failure
+static int connectSocket(const std::string& path)
+{
+    struct sockaddr_un addr;
+    if (!socketAddress(path, addr))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//A long running process that does the jobs sent to its unix socket. The display
+//is opened once, vpp instances and output surface pools of finished jobs are
+//kept for the next ones. Decoders and encoders are configured per stream, so
+//each job still creates its own. At most --parallel jobs run at once, the
+//others wait for a slot.
+class TranscodeDaemon
+{
+public:
+    TranscodeDaemon()
+        : m_app(NULL)
+        , m_fd(-1)
+        , m_cond(m_lock)
+        , m_slots(0)
+        , m_running(0)
+        , m_connections(0)
+        , m_jobs(0)
+        , m_stopping(false)
+    {
+    }
+
+    ~TranscodeDaemon()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+            unlink(m_path.c_str());
+        }
+    }
+
+    bool init(char* app, const std::string& path)
+    {
+        m_app = app;
+        m_slots = s_parallel;
+        if (!m_slots)
+            m_slots = sysconf(_SC_NPROCESSORS_ONLN);
+        struct sockaddr_un addr;
+        if (!socketAddress(path, addr))
+            return false;
+        //a socket file nobody listens on is left over from a daemon that died
+        int fd = connectSocket(path);
+        if (fd >= 0) {
+            close(fd);
+            fprintf(stderr, "a daemon is running on %s\n", path.c_str());
+            return false;
+        }
+        unlink(path.c_str());
         m_display = createVADisplay();
         if (!m_display) {
-            printf("create display failed");
+            ERROR("create display failed");
             return false;
         }
-        if (!createVpp()) {
-            ERROR("create vpp failed");
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            ERROR("create socket failed: %s", strerror(errno));
             return false;
         }
-        m_input = createInput(m_cmdParam, m_display);
-        m_output = createOutput(m_cmdParam, m_display, m_input->getFourcc());
-        if (!m_input || !m_output) {
-            ERROR("create input or output failed");
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, SOMAXCONN)) {
+            ERROR("listen on %s failed: %s", path.c_str(), strerror(errno));
+            close(fd);
             return false;
         }
-        m_allocator = createAllocator(m_output, m_display, m_cmdParam.m_encParams.ipPeriod);
-        return bool(m_allocator);
+        m_fd = fd;
+        m_path = path;
+        return true;
     }
 
+    //till a shutdown request, then wait for the open connections
     bool run()
     {
-
-        SharedPtr<VideoFrame> src;
-        FpsCalc fps;
-        uint32_t count = 0;
-        while (m_input->read(src)) {
-            SharedPtr<VideoFrame> dest = m_allocator->alloc();
-            if (!dest) {
-                ERROR("failed to get output frame");
+        printf("listening on %s, %d jobs at a time\n", m_path.c_str(), m_slots);
+        fflush(stdout);
+        bool ret = true;
+        while (1) {
+            int fd = accept4(m_fd, NULL, NULL, SOCK_CLOEXEC);
+            AutoLock lock(m_lock);
+            if (m_stopping) {
+                if (fd >= 0)
+                    close(fd);
                 break;
             }
-//disable scale for performance measure
-//#define DISABLE_SCALE 1
-#ifndef DISABLE_SCALE
-            YamiStatus status = m_vpp->process(src, dest);
-            if (status != YAMI_SUCCESS) {
-                ERROR("failed to scale yami return %d", status);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                ERROR("accept failed: %s", strerror(errno));
+                ret = false;
                 break;
             }
-#else
-            dest = src;
-#endif
+            Connection* connection = new Connection;
+            connection->daemon = this;
+            connection->fd = fd;
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, startConnection, connection)) {
+                ERROR("create connection thread failed");
+                close(fd);
+                delete connection;
+                continue;
+            }
+            pthread_detach(thread);
+            m_connections++;
+        }
+        AutoLock lock(m_lock);
+        while (m_connections)
+            m_cond.wait();
+        printf("daemon done, %d jobs\n", m_jobs);
+        return ret;
+    }
 
-            if(!m_output->output(dest))
-                break;
-            count++;
-            fps.addFrame();
-            if(count >= m_cmdParam.frameCount)
-                break;
+private:
+    struct Connection {
+        TranscodeDaemon* daemon;
+        int fd;
+    };
+
+    struct Job {
+        Job()
+            : daemon(NULL)
+            , frames(0)
+            , done(false)
+            , ok(false)
+        {
         }
-        src.reset();
-        m_output->output(src);
+        TranscodeDaemon* daemon;
+        TranscodeParams para;
+        std::string name;
+        SharedPtr<TranscodeTest> trans;
+        uint64_t frames;
+        bool done;
+        bool ok;
+    };
 
-        fps.log();
+    static void* startConnection(void* arg)
+    {
+        Connection* connection = (Connection*)arg;
+        connection->daemon->serve(connection->fd);
+        delete connection;
+        return NULL;
+    }
 
-        return true;
+    static void* startJob(void* job)
+    {
+        ((Job*)job)->daemon->runJob(*(Job*)job);
+        return NULL;
     }
-private:
-    bool createVpp()
+
+    void serve(int fd)
     {
-        NativeDisplay nativeDisplay;
-        nativeDisplay.type = NATIVE_DISPLAY_VA;
-        nativeDisplay.handle = (intptr_t)*m_display;
-        m_vpp.reset(createVideoPostProcess(YAMI_VPP_SCALER), releaseVideoPostProcess);
-        return m_vpp->setNativeDisplay(nativeDisplay) == YAMI_SUCCESS;
+        std::string request;
+        if (waitRequest(fd, request)) {
+            if (request == "shutdown")
+                stop(fd);
+            else if (!request.compare(0, 4, "job "))
+                serveJob(fd, request.substr(4));
+            else
+                writeMessage(fd, "error unknown request");
+        }
+        close(fd);
+        AutoLock lock(m_lock);
+        m_connections--;
+        m_cond.broadcast();
     }
 
+    //false if the client sent nothing within REQUEST_TIMEOUT, or we are stopping.
+    //nothing is sent either if someone only checked that we are running
+    bool waitRequest(int fd, std::string& request)
+    {
+        struct timeval timeout = { REQUEST_TIMEOUT / 1000, (REQUEST_TIMEOUT % 1000) * 1000 };
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)))
+            return false;
+        {
+            AutoLock lock(m_lock);
+            if (m_stopping)
+                return false;
+            m_idle.insert(fd);
+        }
+        bool ret = readMessage(fd, request);
+        AutoLock lock(m_lock);
+        m_idle.erase(fd);
+        return ret;
+    }
+
+    void stop(int fd)
+    {
+        {
+            AutoLock lock(m_lock);
+            m_stopping = true;
+            //connections still waiting for their request end now, run() waits for them
+            for (std::set<int>::iterator it = m_idle.begin(); it != m_idle.end(); ++it)
+                shutdown(*it, SHUT_RD);
+        }
+        //wakes up accept()
+        shutdown(m_fd, SHUT_RDWR);
+        writeMessage(fd, "ok");
+    }
+
+    void serveJob(int fd, const std::string& options)
+    {
+        Job job;
+        job.daemon = this;
+        if (!parseJob(m_app, options, job.para)) {
+            writeMessage(fd, "error bad job options");
+            return;
+        }
+        char name[32];
+        {
+            AutoLock lock(m_lock);
+            if (m_stopping) {
+                writeMessage(fd, "error shutting down");
+                return;
+            }
+            snprintf(name, sizeof(name), "job %d", ++m_jobs);
+        }
+        job.name = name;
+        job.trans.reset(new TranscodeTest(&m_warm));
+        bool connected = writeMessage(fd, "accepted");
+        uint64_t start = now();
+        {
+            AutoLock lock(m_lock);
+            while (m_running >= m_slots)
+                m_cond.wait();
+            m_running++;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, startJob, &job)) {
+            ERROR("create thread for %s failed", job.name.c_str());
+        }
+        else {
+            //the job runs on its own thread, we report its progress
+            uint64_t next = now() + PROGRESS_INTERVAL * 1000000ULL;
+            while (1) {
+                bool done;
+                {
+                    AutoLock lock(m_lock);
+                    if (!job.done)
+                        m_cond.timedWait(PROGRESS_INTERVAL);
+                    done = job.done;
+                }
+                if (done)
+                    break;
+                if (connected && now() >= next) {
+                    char progress[32];
+                    snprintf(progress, sizeof(progress), "progress %llu", (unsigned long long)job.trans->progress());
+                    connected = writeMessage(fd, progress);
+                    next += PROGRESS_INTERVAL * 1000000ULL;
+                }
+            }
+            pthread_join(thread, NULL);
+        }
+        //give back vpp and surfaces before the next job takes the slot
+        job.trans.reset();
+        {
+            AutoLock lock(m_lock);
+            m_running--;
+            m_cond.broadcast();
+        }
+        char done[64];
+        snprintf(done, sizeof(done), "done %s %llu %.3f", job.ok ? "ok" : "failed", (unsigned long long)job.frames,
+            (now() - start) / 1e9);
+        printf("%s: %s\n", job.name.c_str(), done);
+        fflush(stdout);
+        if (connected)
+            writeMessage(fd, done);
+    }
+
+    //on the thread of the job, so its --affinity pins nothing else
+    void runJob(Job& job)
+    {
+        bool ok = applyAffinity(job.para.affinity) && job.trans->init(job.para, m_display)
+            && job.trans->run(job.name);
+        AutoLock lock(m_lock);
+        job.ok = ok;
+        job.frames = job.trans->frames();
+        job.done = true;
+        m_cond.broadcast();
+    }
+
+    //milliseconds between progress replies
+    static const uint32_t PROGRESS_INTERVAL = 500;
+    //milliseconds a client has to send its request after connecting
+    static const uint32_t REQUEST_TIMEOUT = 5000;
+
+    char* m_app;
+    std::string m_path;
+    int m_fd;
     SharedPtr<VADisplay> m_display;
-    SharedPtr<VppInput> m_input;
-    SharedPtr<VppOutput> m_output;
-    SharedPtr<FrameAllocator> m_allocator;
-    SharedPtr<IVideoPostProcess> m_vpp;
-    TranscodeParams m_cmdParam;
+    WarmPool m_warm;
+    Lock m_lock;
+    //one condition for slots, finished jobs and closed connections
+    Condition m_cond;
+    uint32_t m_slots;
+    uint32_t m_running;
+    uint32_t m_connections;
+    //connections waiting for their request
+    std::set<int> m_idle;
+    int m_jobs;
+    bool m_stopping;
+    DISALLOW_COPY_AND_ASSIGN(TranscodeDaemon);
+};
+
+//Sends every job to a daemon on its own connection, so they run as parallel as
+//the daemon allows, and prints the replies.
+class TranscodeClient
+{
+public:
+    //false if any job failed
+    bool run()
+    {
+        bool ret = true;
+        std::vector<Request> requests(s_jobs.size());
+        std::vector<pthread_t> threads;
+        for (size_t i = 0; i < requests.size(); i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "job %d", (int)i + 1);
+            requests[i].name = name;
+            requests[i].message = "job " + s_jobs[i];
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, start, &requests[i])) {
+                ERROR("create request thread failed");
+                requests.resize(i);
+                ret = false;
+                break;
+            }
+            threads.push_back(thread);
+        }
+        for (size_t i = 0; i < threads.size(); i++) {
+            pthread_join(threads[i], NULL);
+            if (!requests[i].ok)
+                ret = false;
+        }
+        if (s_shutdown) {
+            Request request;
+            request.name = "shutdown";
+            request.message = "shutdown";
+            submit(request);
+            ret = ret && request.ok;
+        }
+        return ret;
+    }
+
+private:
+    struct Request {
+        Request()
+            : ok(false)
+        {
+        }
+        std::string name;
+        std::string message;
+        bool ok;
+    };
+
+    static void* start(void* request)
+    {
+        submit(*(Request*)request);
+        return NULL;
+    }
+
+    static void submit(Request& request)
+    {
+        int fd = connectSocket(s_connect);
+        if (fd < 0) {
+            fprintf(stderr, "%s: connect to %s failed\n", request.name.c_str(), s_connect.c_str());
+            return;
+        }
+        if (writeMessage(fd, request.message)) {
+            std::string reply;
+            while (readMessage(fd, reply)) {
+                printf("%s: %s\n", request.name.c_str(), reply.c_str());
+                fflush(stdout);
+                if (reply == "ok" || !reply.compare(0, 7, "done ok"))
+                    request.ok = true;
+            }
+        }
+        close(fd);
+    }
 };
 
 int main(int argc, char** argv)
 {
+    TranscodeParams para;
+    if (!processCmdLine(argc, argv, para) || !applyProcessOptions(para)) {
+        ERROR("init transcode with command line parameters failed");
+        return -1;
+    }
+    if (!s_daemon.empty()) {
+        TranscodeDaemon daemon;
+        if (!daemon.init(argv[0], s_daemon) || !daemon.run())
+            return -1;
+        return 0;
+    }
+    if (!s_connect.empty()) {
+        TranscodeClient client;
+        if (!client.run()) {
+            ERROR("some jobs failed");
+            return -1;
+        }
+        return 0;
+    }
+    if (!s_jobs.empty()) {
+        TranscodeJobs jobs;
+        if (!jobs.init(argv[0]))
+            return -1;
+        if (!jobs.run()) {
+            ERROR("some jobs failed");
+            return -1;
+        }
+        printf("transcode done\n");
+        return 0;
+    }
 
+    SharedPtr<VADisplay> display = createVADisplay();
+    if (!display) {
+        ERROR("create display failed");
+        return -1;
+    }
     TranscodeTest trans;
-    if (!trans.init(argc, argv)) {
+    if (!trans.init(para, display)) {
         ERROR("init transcode with command line parameters failed");
         return -1;
     }
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//checks the sse2 kernels of CpuColorConvert against its scalar ones, built
+//in colorscalar.cpp, for every conversion on odd sizes, random and saturated
+//samples, on the caller and on a pool. then measures both on 1080p frames.
+//build with "make colorbench", it is not installed. exits 1 on a difference.
+
+#include "common/CpuColorConvert.h"
+#include "common/common_def.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+namespace YamiMediaCodec {
+//in colorscalar.cpp
+bool convertScalar(const CpuImage& dest, const CpuImage& src);
+};
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const uint32_t SOURCES[] = { YAMI_FOURCC_NV12, YAMI_FOURCC_I420, YAMI_FOURCC_YV12,
+    YAMI_FOURCC_YUY2, YAMI_FOURCC_P010 };
+static const uint32_t DESTS[] = { YAMI_FOURCC_NV12, YAMI_FOURCC_I420, YAMI_FOURCC_YV12 };
+
+//an image of fourcc in its own buffer
+struct Image {
+    Image(uint32_t fourcc, uint32_t width, uint32_t height)
+        : buffer(CpuColorConvert::layout(image, fourcc, width, height, NULL))
+    {
+        CpuColorConvert::layout(image, fourcc, width, height, &buffer[0]);
+    }
+    CpuImage image;
+    std::vector<uint8_t> buffer;
+};
+
+static const char* name(uint32_t fourcc)
+{
+    static char names[2][5];
+    static int next = 0;
+    char* n = names[next++ & 1];
+    memcpy(n, &fourcc, 4);
+    n[4] = 0;
+    return n;
+}
+
+//saturated: all bits set, p010 then overflows the dither add
+static bool check(CpuColorConvert& convert, uint32_t src, uint32_t dest, uint32_t width, uint32_t height,
+    bool saturated)
+{
+    Image in(src, width, height);
+    for (size_t i = 0; i < in.buffer.size(); i++)
+        in.buffer[i] = saturated ? 0xff : rand();
+    Image simd(dest, width, height);
+    Image scalar(dest, width, height);
+    //the pattern shows rows or samples a kernel did not write
+    memset(&simd.buffer[0], 0xcd, simd.buffer.size());
+    memset(&scalar.buffer[0], 0xcd, scalar.buffer.size());
+    if (!convert.convert(simd.image, in.image) || !convertScalar(scalar.image, in.image)) {
+        fprintf(stderr, "FAILED: convert %s to %s %ux%u\n", name(src), name(dest), width, height);
+        return false;
+    }
+    for (size_t i = 0; i < simd.buffer.size(); i++) {
+        if (simd.buffer[i] != scalar.buffer[i]) {
+            fprintf(stderr, "FAILED: %s to %s %ux%u%s, byte %u is %u, scalar has %u\n", name(src), name(dest),
+                width, height, saturated ? " saturated" : "", (uint32_t)i, simd.buffer[i], scalar.buffer[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+//milliseconds per frame
+static double measure(bool simd, CpuColorConvert& convert, const CpuImage& dest, const CpuImage& src)
+{
+    const uint32_t frames = 50;
+    uint64_t start = now();
+    for (uint32_t i = 0; i < frames; i++) {
+        if (simd)
+            convert.convert(dest, src);
+        else
+            convertScalar(dest, src);
+    }
+    return (now() - start) / 1e6 / frames;
+}
+
+int main()
+{
+#if !defined(__SSE2__)
+    printf("no sse2 here, both sides run the scalar kernels\n");
+#endif
+    //widths around the 8 and 16 sample steps of the kernels, odd sizes for the chroma edges
+    static const uint32_t sizes[][2] = { { 1, 1 }, { 2, 2 }, { 7, 3 }, { 15, 5 }, { 16, 4 }, { 17, 9 },
+        { 33, 17 }, { 255, 7 }, { 257, 33 }, { 641, 361 }, { 1921, 1081 } };
+    int failed = 0;
+    int checks = 0;
+    for (uint32_t threads = 0; threads <= 3; threads += 3) {
+        CpuColorConvert convert(threads);
+        for (size_t s = 0; s < N_ELEMENTS(SOURCES); s++) {
+            for (size_t d = 0; d < N_ELEMENTS(DESTS); d++) {
+                if (!CpuColorConvert::isSupported(SOURCES[s], DESTS[d]))
+                    continue;
+                for (size_t z = 0; z < N_ELEMENTS(sizes); z++) {
+                    for (int saturated = 0; saturated < 2; saturated++) {
+                        checks++;
+                        if (!check(convert, SOURCES[s], DESTS[d], sizes[z][0], sizes[z][1], saturated))
+                            failed++;
+                    }
+                }
+            }
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "%d of %d checks failed\n", failed, checks);
+        return 1;
+    }
+    printf("%d checks passed, sse2 and scalar agree\n", checks);
+
+    //one thread, so the kernels are compared, not the banding
+    CpuColorConvert convert;
+    printf("1920x1080, one thread, ms per frame\n%-14s %9s %9s %9s %10s\n", "", "scalar", "sse2", "speed up", "sse2 MB/s");
+    for (size_t s = 0; s < N_ELEMENTS(SOURCES); s++) {
+        for (size_t d = 0; d < N_ELEMENTS(DESTS); d++) {
+            if (!CpuColorConvert::isSupported(SOURCES[s], DESTS[d]))
+                continue;
+            Image in(SOURCES[s], 1920, 1080);
+            for (size_t i = 0; i < in.buffer.size(); i++)
+                in.buffer[i] = rand();
+            Image out(DESTS[d], 1920, 1080);
+            //warm up caches and pages
+            convert.convert(out.image, in.image);
+            convertScalar(out.image, in.image);
+            double scalar = measure(false, convert, out.image, in.image);
+            double simd = measure(true, convert, out.image, in.image);
+            char pair[16];
+            snprintf(pair, sizeof(pair), "%s to %s", name(SOURCES[s]), name(DESTS[d]));
+            printf("%-14s %9.3f %9.3f %9.2f %10.0f\n", pair, scalar, simd, scalar / simd,
+                in.buffer.size() / (simd / 1e3) / 1e6);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//CpuColorConvert with the sse2 kernels compiled out, what colorbench compares
+//the sse2 ones with. renamed, so the linker can't mix the two up
+#undef __SSE2__
+#define CpuColorConvert ScalarColorConvert
+#include "common/CpuColorConvert.h"
+
+namespace YamiMediaCodec {
+
+bool convertScalar(const CpuImage& dest, const CpuImage& src)
+{
+    static ScalarColorConvert convert;
+    return convert.convert(dest, src);
+}
+};
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//the cross node penalty --affinity avoids. a buffer is faulted in by a thread
+//pinned to node a, then read by a thread pinned to node b, for every pair of
+//nodes: sequential read bandwidth, as frame copies do, and dependent load
+//latency. the diagonal is what a pipeline pinned with --affinity gets, the
+//rest is what it may get unpinned. the first argument is the buffer size in MB.
+//build with "make numabench", it is not installed.
+
+#include "common/CpuAffinity.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int countNodes()
+{
+    int nodes = 0;
+    char path[128];
+    while (1) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nodes);
+        if (access(path, F_OK))
+            break;
+        nodes++;
+    }
+    return nodes;
+}
+
+struct Job {
+    CpuAffinity affinity;
+    size_t size;
+    uint64_t* data;
+    //results of a reader
+    double mbps;
+    double latencyNs;
+    uint64_t sum;
+};
+
+//faults the buffer in on the node of the thread, as the first touch of a frame does
+static void* fill(void* arg)
+{
+    Job& job = *(Job*)arg;
+    if (!job.affinity.apply())
+        return NULL;
+    size_t count = job.size / sizeof(uint64_t);
+    job.data = (uint64_t*)malloc(job.size);
+    if (!job.data)
+        return NULL;
+    //a random cycle through one slot per cache line, for the latency run
+    const size_t stride = 64 / sizeof(uint64_t);
+    size_t lines = count / stride;
+    std::vector<uint32_t> order(lines);
+    for (size_t i = 0; i < lines; i++)
+        order[i] = i;
+    uint64_t seed = 88172645463325252ULL;
+    for (size_t i = lines - 1; i > 0; i--) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        size_t j = seed % (i + 1);
+        uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (size_t i = 0; i < count; i++)
+        job.data[i] = i;
+    for (size_t i = 0; i < lines; i++)
+        job.data[order[i] * stride] = order[(i + 1) % lines] * stride;
+    return NULL;
+}
+
+static void* measure(void* arg)
+{
+    Job& job = *(Job*)arg;
+    if (!job.affinity.apply())
+        return NULL;
+    size_t count = job.size / sizeof(uint64_t);
+    uint64_t sum = 0;
+    uint64_t start = now();
+    const int passes = 4;
+    for (int p = 0; p < passes; p++) {
+        for (size_t i = 0; i < count; i++)
+            sum += job.data[i];
+    }
+    job.mbps = (double)job.size * passes / ((now() - start) / 1e9) / 1e6;
+
+    const size_t loads = 1 << 22;
+    uint64_t next = 0;
+    start = now();
+    for (size_t i = 0; i < loads; i++)
+        next = job.data[next];
+    job.latencyNs = (double)(now() - start) / loads;
+    job.sum = sum + next;
+    return NULL;
+}
+
+//without numa info there is one node, cpu 0
+static bool pin(CpuAffinity& affinity, int node, bool numa)
+{
+    char spec[32];
+    snprintf(spec, sizeof(spec), "node:%d", node);
+    return affinity.parse(numa ? spec : "0");
+}
+
+static bool run(void* (*func)(void*), Job& job)
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, func, &job)) {
+        fprintf(stderr, "create thread failed\n");
+        return false;
+    }
+    pthread_join(thread, NULL);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = (argc > 1 ? atoi(argv[1]) : 256) << 20;
+    if (size < (1 << 20)) {
+        fprintf(stderr, "usage: %s [buffer size in MB, at least 1]\n", argv[0]);
+        return 1;
+    }
+    int nodes = countNodes();
+    bool numa = nodes > 0;
+    if (nodes <= 1)
+        printf("%d numa node, no cross node penalty here, the numbers are the local baseline\n", nodes);
+    if (!numa)
+        nodes = 1;
+
+    std::vector<std::vector<Job> > results(nodes, std::vector<Job>(nodes));
+    for (int a = 0; a < nodes; a++) {
+        Job owner;
+        if (!pin(owner.affinity, a, numa))
+            return 1;
+        owner.size = size;
+        owner.data = NULL;
+        if (!run(fill, owner) || !owner.data) {
+            fprintf(stderr, "fill buffer on node %d failed\n", a);
+            return 1;
+        }
+        for (int b = 0; b < nodes; b++) {
+            Job& reader = results[a][b];
+            reader = owner;
+            if (!pin(reader.affinity, b, numa) || !run(measure, reader)) {
+                free(owner.data);
+                return 1;
+            }
+        }
+        free(owner.data);
+    }
+
+    printf("%zu MB buffer, rows: node the memory is on, columns: node of the reader\n", size >> 20);
+    printf("read MB/s\n%8s", "");
+    for (int b = 0; b < nodes; b++)
+        printf(" %10d", b);
+    printf("\n");
+    for (int a = 0; a < nodes; a++) {
+        printf("%8d", a);
+        for (int b = 0; b < nodes; b++)
+            printf(" %10.0f", results[a][b].mbps);
+        printf("\n");
+    }
+    printf("load latency ns\n%8s", "");
+    for (int b = 0; b < nodes; b++)
+        printf(" %10d", b);
+    printf("\n");
+    for (int a = 0; a < nodes; a++) {
+        printf("%8d", a);
+        for (int b = 0; b < nodes; b++)
+            printf(" %10.1f", results[a][b].latencyNs);
+        printf("\n");
+    }
+    //local is what --affinity gives, remote what an unpinned pipeline may get
+    double local = 0, remote = 0;
+    for (int a = 0; a < nodes; a++) {
+        for (int b = 0; b < nodes; b++) {
+            if (a == b)
+                local += results[a][b].mbps / nodes;
+            else
+                remote += results[a][b].mbps / (nodes * (nodes - 1));
+        }
+    }
+    if (nodes > 1)
+        printf("pinned with --affinity %.0f MB/s, across nodes %.0f MB/s, %.0f%% slower\n", local, remote,
+            100 * (1 - remote / local));
+    //keeps the loops from being optimized away
+    if (results[0][0].sum == 42)
+        printf("\n");
+    return 0;
+}
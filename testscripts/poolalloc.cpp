@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//checks that VideoPool::alloc() and the release of its frames do not touch the
+//heap once every buffer has been out once. operator new and delete are counted.
+//build with "make poolalloc", it is not installed. exits 1 if the heap is used.
+
+#include "common/videopool.h"
+
+#include <new>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+static uint64_t s_news = 0;
+static uint64_t s_deletes = 0;
+
+//not inlined, gcc would see malloc and free meet new and delete and warn
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    __atomic_add_fetch(&s_news, 1, __ATOMIC_RELAXED);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) throw()
+{
+    if (p)
+        __atomic_add_fetch(&s_deletes, 1, __ATOMIC_RELAXED);
+    free(p);
+}
+
+#if __cplusplus >= 201402L
+void operator delete(void* p, size_t) throw()
+{
+    operator delete(p);
+}
+#endif
+
+static uint64_t heapCalls()
+{
+    return __atomic_load_n(&s_news, __ATOMIC_RELAXED) + __atomic_load_n(&s_deletes, __ATOMIC_RELAXED);
+}
+
+struct Buffer {
+    uint32_t index;
+};
+
+typedef VideoPool<Buffer> Pool;
+
+static SharedPtr<Pool> createPool(uint32_t size)
+{
+    std::deque<SharedPtr<Buffer> > buffers;
+    for (uint32_t i = 0; i < size; i++) {
+        SharedPtr<Buffer> buffer(new Buffer);
+        buffer->index = i;
+        buffers.push_back(buffer);
+    }
+    return SharedPtr<Pool>(new Pool(buffers));
+}
+
+//takes held frames out of the pool, then gives them back, cycles times
+static bool cycle(Pool& pool, std::vector<SharedPtr<Buffer> >& held, uint32_t cycles)
+{
+    for (uint32_t c = 0; c < cycles; c++) {
+        for (size_t i = 0; i < held.size(); i++) {
+            held[i] = pool.alloc();
+            if (!held[i])
+                return false;
+        }
+        for (size_t i = 0; i < held.size(); i++)
+            held[i].reset();
+    }
+    return true;
+}
+
+//frames released on another thread, as pipeline stages do
+struct Release {
+    std::vector<SharedPtr<Buffer> >* held;
+};
+
+static void* release(void* arg)
+{
+    std::vector<SharedPtr<Buffer> >& held = *((Release*)arg)->held;
+    for (size_t i = 0; i < held.size(); i++)
+        held[i].reset();
+    return NULL;
+}
+
+int main()
+{
+#if __cplusplus <= 199711L
+    printf("tr1::shared_ptr takes no allocator, alloc() allocates a control block, nothing to check\n");
+    return 0;
+#endif
+    const uint32_t poolSize = 8;
+    const uint32_t cycles = 100000;
+    int failed = 0;
+    SharedPtr<Pool> pool = createPool(poolSize);
+    for (uint32_t held = 1; held <= poolSize; held++) {
+        std::vector<SharedPtr<Buffer> > frames(held);
+        //warm up, every buffer is out once
+        if (!cycle(*pool, frames, poolSize)) {
+            fprintf(stderr, "FAILED: pool of %u ran out with %u held\n", poolSize, held);
+            return 1;
+        }
+        uint64_t before = heapCalls();
+        cycle(*pool, frames, cycles);
+        uint64_t calls = heapCalls() - before;
+        printf("%u of %u frames held, %u cycles: %llu heap calls\n", held, poolSize, cycles, (unsigned long long)calls);
+        if (calls)
+            failed++;
+    }
+
+    //the thread itself allocates, so count around the allocs only
+    std::vector<SharedPtr<Buffer> > frames(poolSize);
+    uint64_t calls = 0;
+    for (uint32_t c = 0; c < 1000; c++) {
+        uint64_t before = heapCalls();
+        for (uint32_t i = 0; i < poolSize; i++)
+            frames[i] = pool->alloc();
+        calls += heapCalls() - before;
+        Release arg = { &frames };
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, release, &arg)) {
+            fprintf(stderr, "FAILED: create thread\n");
+            return 1;
+        }
+        pthread_join(thread, NULL);
+    }
+    printf("released on another thread, 1000 cycles: %llu heap calls in alloc()\n", (unsigned long long)calls);
+    if (calls)
+        failed++;
+
+    if (failed) {
+        fprintf(stderr, "FAILED: %d cases used the heap\n", failed);
+        return 1;
+    }
+    printf("no heap calls in steady state\n");
+    return 0;
+}
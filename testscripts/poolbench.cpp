@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//checks ThreadPool, then measures task and parallelFor overhead against a
+//thread per call, and the speed up of a memory bound loop for 1 to n threads,
+//n is the first argument or the online cpus.
+//build with "make poolbench", it is not installed. exits 1 if a check fails.
+
+#include "common/ThreadPool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace YamiMediaCodec;
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int s_failed = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        s_failed++;
+    }
+}
+
+//a position weighted sum of data, the same however the range is cut
+struct Hash {
+    Hash(const std::vector<uint8_t>& data)
+        : data(data)
+        , sum(0)
+    {
+    }
+    void operator()(uint32_t first, uint32_t last)
+    {
+        uint64_t h = 0;
+        for (uint32_t i = first; i < last; i++)
+            h += (uint64_t)data[i] * (i | 1);
+        __atomic_add_fetch(&sum, h, __ATOMIC_RELAXED);
+    }
+    const std::vector<uint8_t>& data;
+    uint64_t sum;
+};
+
+//covers every index once
+struct Mark {
+    explicit Mark(uint32_t size)
+        : marks(size)
+    {
+    }
+    void operator()(uint32_t first, uint32_t last)
+    {
+        for (uint32_t i = first; i < last; i++)
+            __atomic_add_fetch(&marks[i], 1, __ATOMIC_RELAXED);
+    }
+    std::vector<uint32_t> marks;
+};
+
+struct Nothing {
+    void operator()(uint32_t, uint32_t) {}
+};
+
+//fib(n) with a task for fib(n - 1), waited for from inside the pool
+class Fib : public Future<uint64_t> {
+public:
+    Fib(ThreadPool& pool, uint32_t n)
+        : m_pool(pool)
+        , m_n(n)
+    {
+    }
+
+private:
+    uint64_t compute()
+    {
+        if (m_n < 2)
+            return m_n;
+        SharedPtr<Fib> first(new Fib(m_pool, m_n - 1));
+        m_pool.submit(first);
+        Fib second(m_pool, m_n - 2);
+        return second.compute() + first->get();
+    }
+    ThreadPool& m_pool;
+    uint32_t m_n;
+};
+
+class Sleep : public Task {
+public:
+    explicit Sleep(uint32_t ms)
+        : m_ms(ms)
+    {
+    }
+
+private:
+    void run() { usleep(m_ms * 1000); }
+    uint32_t m_ms;
+};
+
+class Empty : public Task {
+private:
+    void run() {}
+};
+
+static void checks(uint32_t threads)
+{
+    ThreadPool pool(threads);
+    for (uint32_t size = 0; size < 2000; size = size * 3 + 1) {
+        for (uint32_t grain = 1; grain < 100; grain *= 7) {
+            Mark mark(size);
+            pool.parallelFor(0, size, grain, mark);
+            bool once = true;
+            for (uint32_t i = 0; i < size; i++)
+                once = once && mark.marks[i] == 1;
+            check(once, "parallelFor covers every index once");
+        }
+    }
+    SharedPtr<Fib> fib(new Fib(pool, 20));
+    pool.submit(fib);
+    check(fib->get() == 6765, "nested futures");
+    SharedPtr<Task> sleep(new Sleep(200));
+    pool.submit(sleep);
+    if (pool.threads())
+        check(!sleep->wait(10), "timed wait times out");
+    check(sleep->wait(2000), "timed wait returns when done");
+}
+
+static void* startEmpty(void*)
+{
+    return NULL;
+}
+
+//what the components did before, a thread for each piece of work
+static double threadPerCall(uint32_t threads, uint32_t calls)
+{
+    uint64_t start = now();
+    std::vector<pthread_t> ids(threads);
+    for (uint32_t c = 0; c < calls; c++) {
+        for (uint32_t i = 0; i < threads; i++)
+            pthread_create(&ids[i], NULL, startEmpty, NULL);
+        for (uint32_t i = 0; i < threads; i++)
+            pthread_join(ids[i], NULL);
+    }
+    return (now() - start) / 1e3 / calls;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t cpus = ThreadPool::defaultThreads();
+    uint32_t maxThreads = argc > 1 ? atoi(argv[1]) : cpus;
+    if (!maxThreads)
+        maxThreads = 1;
+
+    checks(1);
+    checks(maxThreads);
+    CpuAffinity affinity;
+    if (affinity.parse("0")) {
+        ThreadPool pinned(2, &affinity);
+        Mark mark(1000);
+        pinned.parallelFor(0, 1000, 1, mark);
+        check(mark.marks[999] == 1, "pinned pool");
+    }
+    if (s_failed) {
+        fprintf(stderr, "%d checks failed\n", s_failed);
+        return 1;
+    }
+    printf("checks passed\n");
+
+    {
+        ThreadPool pool(maxThreads);
+        const uint32_t tasks = 100000;
+        std::vector<SharedPtr<Task> > all;
+        all.reserve(tasks);
+        uint64_t start = now();
+        for (uint32_t i = 0; i < tasks; i++) {
+            all.push_back(SharedPtr<Task>(new Empty));
+            pool.submit(all.back());
+        }
+        for (uint32_t i = 0; i < tasks; i++)
+            all[i]->wait();
+        printf("%u threads: submit and wait %.0f tasks/s\n", maxThreads, tasks / ((now() - start) / 1e9));
+
+        const uint32_t calls = 10000;
+        Nothing nothing;
+        start = now();
+        for (uint32_t i = 0; i < calls; i++)
+            pool.parallelFor(0, maxThreads * 16, 1, nothing);
+        printf("%u threads: empty parallelFor %.2f us, thread per call %.2f us\n", maxThreads,
+            (now() - start) / 1e3 / calls, threadPerCall(maxThreads, calls / 10));
+    }
+
+    std::vector<uint8_t> data(64 << 20);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 2654435761U >> 24);
+    printf("%8s %12s %10s\n", "threads", "MB/s", "speed up");
+    double serial = 0;
+    uint64_t expected = 0;
+    //0 is the caller alone, then powers of two and maxThreads
+    std::vector<uint32_t> counts(1, 0);
+    for (uint32_t threads = 1; threads < maxThreads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(maxThreads);
+    for (size_t c = 0; c < counts.size(); c++) {
+        uint32_t threads = counts[c];
+        ThreadPool pool(threads ? threads : 1);
+        Hash hash(data);
+        uint64_t start = now();
+        if (threads)
+            pool.parallelFor(0, data.size(), 1 << 16, hash);
+        else
+            for (uint32_t first = 0; first < data.size(); first += 1 << 16)
+                hash(first, first + (1 << 16));
+        double seconds = (now() - start) / 1e9;
+        if (!threads) {
+            serial = seconds;
+            expected = hash.sum;
+        }
+        else if (hash.sum != expected) {
+            fprintf(stderr, "FAILED: hash with %u threads differs\n", threads);
+            return 1;
+        }
+        printf("%8u %12.0f %10.2f\n", threads, data.size() / seconds / 1e6, serial / seconds);
+    }
+    return 0;
+}
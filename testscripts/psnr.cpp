@@ -13,6 +13,11 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "common/CompressedFrameFile.h"
+#include "common/ThreadPool.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,11 +30,43 @@
 static unsigned char *bufferyuv1 = NULL;
 static unsigned char *bufferyuv2 = NULL;
 
+//sum of the squared differences of rows [first, last) of two planes
+struct SquaredError {
+    SquaredError(const unsigned char* a, const unsigned char* b, int width)
+        : a(a)
+        , b(b)
+        , width(width)
+        , sum(0)
+    {
+    }
+    void operator()(uint32_t first, uint32_t last)
+    {
+        uint64_t rows = 0;
+        for (uint32_t i = first * width; i < last * width; i++) {
+            int d = a[i] - b[i];
+            rows += d * d;
+        }
+        __atomic_add_fetch(&sum, rows, __ATOMIC_RELAXED);
+    }
+    const unsigned char* a;
+    const unsigned char* b;
+    uint32_t width;
+    uint64_t sum;
+};
+
+static double squaredError(YamiMediaCodec::ThreadPool& pool, int width, int height)
+{
+    SquaredError error(bufferyuv1, bufferyuv2, width);
+    pool.parallelFor(0, height, 16, error);
+    return error.sum;
+}
+
 static void print_help(const char* app)
 {
     printf("%s <options>\n", app);
     printf("   -i raw yuv file by software decoder\n");
     printf("   -o raw yuv file by hardward decoder\n");
+    printf("      compressed dumps of yamidecode --compress are read as raw yuv\n");
     printf("   -W width  of video\n");
     printf("   -H height of video\n");
 }
@@ -62,6 +99,8 @@ psnr_calculate(char *filename1, char *filename2, const char *eachpsnr, const cha
     int uvHeight = (height+1)/2;
     int sizey = width*height;
     int sizeuv = uvWidth*uvHeight;
+    //planes are summed up in row bands on all cpus
+    YamiMediaCodec::ThreadPool pool;
 
     fppsnrresult = fopen(psnrresult,"ab+");
     if (NULL==fppsnrresult)
@@ -70,14 +109,14 @@ psnr_calculate(char *filename1, char *filename2, const char *eachpsnr, const cha
         goto error;
     }
 
-    fpraw1=fopen(filename1,"rb");
+    fpraw1=YamiMediaCodec::CompressedFrameFile::open(filename1);
     if (NULL==fpraw1)
     {
         printf("open ref yuv fail\n");
         fprintf(fppsnrresult,"open %s fail\n",filename1);
         goto error;
     }
-    fpraw2=fopen(filename2,"rb");
+    fpraw2=YamiMediaCodec::CompressedFrameFile::open(filename2);
     if (NULL==fpraw2)
     {
         printf("open decode yuv fail\n");
@@ -103,20 +142,13 @@ psnr_calculate(char *filename1, char *filename2, const char *eachpsnr, const cha
 
     while(1)
     {
-        int i, j;
 //calc psnr of y
         sum=0;
         size1=fread(bufferyuv1,sizeof(char),sizey,fpraw1);
         size2=fread(bufferyuv2,sizeof(char),sizey,fpraw2);
         if ((0==size1) || (0==size2) || (size1!=size2))
             break;
-        for(i = 0;i <height ;i++)
-        {
-            for(j = 0;j <width ;j++)
-            {
-                sum += ((bufferyuv1[i*width +j]  -bufferyuv2[i*width + j])*(bufferyuv1[i * width +j ]-bufferyuv2[i *width +j]));
-            }
-        }
+        sum = squaredError(pool, width, height);
         mse = sum/(sizey);
         psny = 10*log10((pow(2,8)-1)*(pow(2,8)-1)/mse);
 
@@ -133,13 +165,7 @@ psnr_calculate(char *filename1, char *filename2, const char *eachpsnr, const cha
         sum=0;
         if ((0==size1) || (0==size2) || (size1!=size2))
             break;
-        for(i = 0;i <uvHeight ;i++)
-        {
-            for(j = 0;j <uvWidth ;j++)
-            {
-                sum += ((bufferyuv1[i*uvWidth +j]  -bufferyuv2[i*uvWidth + j])*(bufferyuv1[i * uvWidth +j ]-bufferyuv2[i *uvWidth +j]));
-            }
-        }
+        sum = squaredError(pool, uvWidth, uvHeight);
         mse = sum/(sizeuv);
         psnu = 10*log10((pow(2,8)-1)*(pow(2,8)-1)/mse);
 //calc v
@@ -151,13 +177,7 @@ psnr_calculate(char *filename1, char *filename2, const char *eachpsnr, const cha
         sum=0;
         if ((0==size1) || (0==size2) || (size1!=size2))
             break;
-        for(i = 0;i <uvHeight ;i++)
-        {
-            for(j = 0;j <uvWidth ;j++)
-            {
-                sum += ((bufferyuv1[i*uvWidth +j]  -bufferyuv2[i*uvWidth + j])*(bufferyuv1[i * uvWidth +j ]-bufferyuv2[i *uvWidth +j]));
-            }
-        }
+        sum = squaredError(pool, uvWidth, uvHeight);
         mse = sum/(sizeuv);
         psnv = 10*log10((pow(2,8)-1)*(pow(2,8)-1)/mse);
 
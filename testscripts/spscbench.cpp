@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//hand-off latency and throughput of SpscQueue against the lock and condition
+//queue VppInputAsync used before, for queue sizes 1 to 16.
+//build with "make spscbench", it is not installed.
+
+#include "common/SpscQueue.h"
+#include "common/condition.h"
+#include "common/lock.h"
+
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+using namespace YamiMediaCodec;
+
+//the old VppInputAsync scheme, one condition for both sides, signal on every call
+class LockedQueue {
+public:
+    explicit LockedQueue(uint32_t capacity)
+        : m_cond(m_lock)
+        , m_capacity(capacity)
+    {
+    }
+    bool push(const uint64_t& item)
+    {
+        AutoLock lock(m_lock);
+        while (m_items.size() >= m_capacity)
+            m_cond.wait();
+        m_items.push_back(item);
+        m_cond.signal();
+        return true;
+    }
+    bool pop(uint64_t& item)
+    {
+        AutoLock lock(m_lock);
+        while (m_items.empty())
+            m_cond.wait();
+        item = m_items.front();
+        m_items.pop_front();
+        m_cond.signal();
+        return true;
+    }
+    uint32_t pop(uint64_t* items, uint32_t max)
+    {
+        return pop(*items) ? 1 : 0;
+    }
+
+private:
+    Lock m_lock;
+    Condition m_cond;
+    std::deque<uint64_t> m_items;
+    uint32_t m_capacity;
+};
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+template <class Q>
+struct Bench {
+    Q* forward;
+    Q* backward;
+    uint64_t count;
+    uint32_t batch;
+
+    //consumer of the throughput run
+    static void* drain(void* arg)
+    {
+        Bench* b = (Bench*)arg;
+        uint64_t items[16];
+        uint64_t got = 0;
+        while (got < b->count)
+            got += b->forward->pop(items, b->batch);
+        return NULL;
+    }
+
+    //echo side of the latency run
+    static void* echo(void* arg)
+    {
+        Bench* b = (Bench*)arg;
+        uint64_t item;
+        for (uint64_t i = 0; i < b->count; i++) {
+            b->forward->pop(item);
+            b->backward->push(item);
+        }
+        return NULL;
+    }
+};
+
+//items per second, producer pushes as fast as it can
+template <class Q>
+static double throughput(uint32_t capacity, uint64_t count, uint32_t batch)
+{
+    Q queue(capacity);
+    Bench<Q> bench = { &queue, NULL, count, batch };
+    pthread_t thread;
+    uint64_t start = now();
+    if (pthread_create(&thread, NULL, Bench<Q>::drain, &bench)) {
+        fprintf(stderr, "create thread failed\n");
+        exit(1);
+    }
+    for (uint64_t i = 0; i < count; i++)
+        queue.push(i);
+    pthread_join(thread, NULL);
+    return count / ((now() - start) / 1e9);
+}
+
+//nanoseconds of one hand-off, half of a ping pong round trip
+template <class Q>
+static double latency(uint32_t capacity, uint64_t count)
+{
+    Q forward(capacity);
+    Q backward(capacity);
+    Bench<Q> bench = { &forward, &backward, count, 1 };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, Bench<Q>::echo, &bench)) {
+        fprintf(stderr, "create thread failed\n");
+        exit(1);
+    }
+    uint64_t start = now();
+    uint64_t item;
+    for (uint64_t i = 0; i < count; i++) {
+        forward.push(i);
+        backward.pop(item);
+    }
+    uint64_t elapsed = now() - start;
+    pthread_join(thread, NULL);
+    return elapsed / 2.0 / count;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t count = argc > 1 ? strtoull(argv[1], NULL, 0) : 1000000;
+    if (!count)
+        count = 1;
+    printf("%llu items per run\n", (unsigned long long)count);
+    printf("%5s %14s %14s %14s %12s %12s\n", "size", "locked /s", "spsc /s", "spsc batch /s",
+        "locked ns", "spsc ns");
+    for (uint32_t size = 1; size <= 16; size *= 2) {
+        printf("%5u %14.0f %14.0f %14.0f %12.0f %12.0f\n", size,
+            throughput<LockedQueue>(size, count, 1),
+            throughput<SpscQueue<uint64_t> >(size, count, 1),
+            throughput<SpscQueue<uint64_t> >(size, count, size),
+            latency<LockedQueue>(size, count / 10 + 1),
+            latency<SpscQueue<uint64_t> >(size, count / 10 + 1));
+    }
+    return 0;
+}